@@ -29,6 +29,11 @@
  #include <udjat/request.h>
  #include <udjat/tools/value.h>
  #include <list>
+ #include <vector>
+ #include <map>
+ #include <unordered_map>
+ #include <mutex>
+ #include <string>
 
  namespace Udjat {
 
@@ -41,9 +46,51 @@
 
 			std::list<Alert> proxies;
 
+			/// @brief Alerts by event, indexed by the event bit.
+			std::vector<Alert *> alerts[16];
+
+			/// @brief Events handled by the agent alerts.
+			uint16_t mask = 0;
+
 			/// @brief Timestamp of the last alert emission.
 			time_t alert_timestamp = time(0);
 
+			/// @brief Pulse alert scheduled for a session.
+			struct Pulse {
+				std::string sid;		///< @brief Session id.
+				Alert *alert;			///< @brief The pulse alert.
+				size_t phase;			///< @brief Session phase (hashed from sid/uid).
+			};
+
+			/// @brief Pulse deadlines by (session, alert).
+			struct {
+				mutable std::mutex guard;
+
+				/// @brief Scheduled pulses ordered by deadline.
+				std::multimap<time_t, Pulse> queue;
+
+				/// @brief Scheduled pulses by session id.
+				std::unordered_map<std::string, std::vector<std::multimap<time_t, Pulse>::iterator>> sessions;
+
+				/// @brief Sessions active before agent creation were scheduled.
+				bool loaded = false;
+
+			} pulses;
+
+			/// @brief Schedule pulses of session (requires an active pulse guard).
+			/// @param sid The session id.
+			/// @param phase The session phase.
+			/// @param from The pulse interval is counted from this time.
+			/// @param activity The session had activity, don't pulse too soon.
+			void schedule(const std::string &sid, size_t phase, time_t from, bool activity);
+
+			/// @brief Remove session pulses (requires an active pulse guard).
+			void unschedule(const std::string &sid);
+
+			/// @brief Get the time of the next pulse (requires an active pulse guard).
+			/// @return Timestamp of the next pulse, 0 if none.
+			time_t next() const noexcept;
+
 			void emit(Abstract::Alert &alert, Session &session) const noexcept;
 
 			struct {
@@ -65,6 +112,10 @@
 			/// @return true if an alert was activated.
 			bool onEvent(Session &session, const Udjat::User::Event event) noexcept;
 
+			/// @brief Process event using the already loaded session attributes.
+			/// @return true if an alert was activated.
+			bool onEvent(Session &session, const Udjat::User::Event event, const Session::Attributes &attributes) noexcept;
+
 			bool push_back(const pugi::xml_node &node, std::shared_ptr<Activatable> activatable) override;
 
 			Value & get(Value &value) const override;
@@ -76,6 +127,11 @@
 			/// @brief Get Agent value (seconds since last alert);
 			time_t get() const noexcept;
 
+			/// @brief Has this agent any alert for the event?
+			inline bool handles(const Udjat::User::Event event) const noexcept {
+				return (mask & event) != 0;
+			}
+
 		};
 
 	}
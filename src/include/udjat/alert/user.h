@@ -25,6 +25,8 @@
  #include <udjat/defs.h>
  #include <udjat/tools/xml.h>
  #include <udjat/tools/user/session.h>
+ #include <memory>
+ #include <vector>
 
  namespace Udjat {
 
@@ -39,6 +41,9 @@
 			struct {
 
 				time_t timer = 0;				///< @brief Emission timer (for pulse alerts).
+				bool batch = false;				///< @brief Emit a single pulse with all the matching sessions?
+				bool spread = false;			///< @brief Spread the session pulses over the interval (opt-in)?
+				time_t jitter = 0;				///< @brief Max random delay added to the pulses.
 				bool system = false;			///< @brief Emit alert for system sessions?
 				bool remote = false;			///< @brief Emit alert for remote sessions?
 				bool locked = false;			///< @brief Emit alert on locked session?
@@ -55,6 +60,9 @@
 
 			} emit;
 
+			/// @brief Compiled session filter, bit 'n' is set if sessions with Attributes::flags = 'n' are allowed.
+			uint16_t filter = 0;
+
 		protected:
 			std::shared_ptr<Activatable> alert;
 
@@ -66,15 +74,40 @@
 				return emit.timer;
 			}
 
+			/// @brief Get the time of the next pulse.
+			/// @details When spreading, every session pulses on its own phase of the interval.
+			/// @param from The current time.
+			/// @param phase The session phase (hashed from its id).
+			/// @param activity The session had activity, wait at least half interval.
+			/// @return The time of the next pulse, with jitter.
+			time_t next(time_t from, size_t phase, bool activity) const;
+
+			/// @brief Is this a batched pulse alert?
+			inline bool batched() const noexcept {
+				return emit.batch;
+			}
+
 			// Emit alert.
 			void activate(const Agent &agent, const Session &session);
 
+			/// @brief Emit a single alert for several sessions.
+			/// @details The sessions are available to the alert as a JSON array in ${sessions}, its size in ${count}.
+			void activate(const Agent &agent, const std::vector<std::shared_ptr<Session>> &sessions);
+
 			bool test(const Udjat::User::Session &session) const noexcept;
 
+			/// @brief Test session attributes against the alert filters.
+			bool test(const Udjat::User::Session::Attributes &attributes) const noexcept;
+
 			inline bool test(Udjat::User::Event event) const noexcept {
 				return (this->event & event) != 0;
 			}
 
+			/// @brief Get the events handled by this alert.
+			inline Udjat::User::Event events() const noexcept {
+				return event;
+			}
+
 		};
 
 	}
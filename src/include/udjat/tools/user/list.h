@@ -24,6 +24,18 @@
  #pragma once
  #include <config.h>
  #include <udjat/defs.h>
+ #include <udjat/tools/value.h>
+ #include <unordered_map>
+ #include <atomic>
+ #include <memory>
+ #include <string>
+ #include <vector>
+ #include <set>
+
+ #ifndef _WIN32
+	#include <sys/types.h>
+	struct sd_login_monitor;
+ #endif // !_WIN32
 
  namespace Udjat {
 
@@ -33,16 +45,71 @@
 
 		/// @brief Singleton with the user's list.
 		class UDJAT_API List {
+		public:
+
+			/// @brief Immutable list of sessions shared with the readers.
+			using Snapshot = std::vector<std::shared_ptr<Session>>;
+
+			/// @brief Sessions grouped by user, published with the session list.
+			struct Users {
+				std::unordered_map<std::string, Snapshot> names;	///< @brief Sessions by lowercase user name.
+#ifndef _WIN32
+				std::unordered_map<uid_t, Snapshot> uids;			///< @brief Sessions by user id.
+#endif // !_WIN32
+			};
+
 		private:
+			friend class Session;
 
 			std::recursive_mutex guard;
 
-			/// @brief Session list.
-			std::list<Session *> sessions;
+			/// @brief Session list (writers only, requires the guard).
+			std::list<std::shared_ptr<Session>> sessions;
+
+			/// @brief Session list published to the readers (use std::atomic_load/std::atomic_store).
+			std::shared_ptr<const Snapshot> published{std::make_shared<Snapshot>()};
+
+			/// @brief User indexes of the published session list (use std::atomic_load/std::atomic_store).
+			std::shared_ptr<const Users> users{std::make_shared<Users>()};
+
+			/// @brief Publish the current session list and the user indexes to the readers (requires the guard).
+			void publish();
+
+			/// @brief Remove session from the list, it will be deleted when no reader is using it (requires the guard).
+			/// @details The removal is not published, call publish() after the last release of a batch.
+			void release(Session *session);
 
 			/// @brief Agent list.
 			std::list<Agent *> agents;
 
+			/// @brief Protects the agent list; the events are delivered with it, never with the list guard.
+			std::recursive_mutex agentguard;
+
+			/// @brief Events handled by the registered agents.
+			std::atomic<uint16_t> events{0};
+
+			class Dispatcher;
+			std::shared_ptr<Dispatcher> dispatcher;	///< @brief Asynchronous event dispatcher.
+
+			/// @brief Number of counted sessions by user (requires the guard).
+#ifdef _WIN32
+			std::unordered_map<std::string, unsigned int> online;
+#else
+			std::unordered_map<uid_t, unsigned int> online;
+#endif // _WIN32
+
+			/// @brief Update the user session count, emit user-online on the first session and user-offline on the last.
+			void count(Session &session, const Event event) noexcept;
+
+			/// @brief Send event to the dispatcher (or to the agents if the dispatcher is disabled).
+			void emit(Session &session, const Event event) noexcept;
+
+			/// @brief Queue event (or deliver it if the dispatcher is disabled).
+			void send(Session &session, const Event event) noexcept;
+
+			/// @brief Deliver event to the agents.
+			static void notify(Session &session, const Event event, const Session::Attributes &attributes) noexcept;
+
 			/// @brief Initialize controller.
 			void init() noexcept;
 
@@ -68,11 +135,103 @@
 
 #else
 
-			Session & find(const char * sid);
+			/// @brief Sessions indexed by logind sid (positions in the session list).
+			std::unordered_map<std::string, std::list<std::shared_ptr<Session>>::iterator> index;
+
+			/// @brief Sessions initialized together on the thread pool.
+			struct Batch;
+
+			/// @brief Create and initialize sessions, resolving their environment in a single /proc scan.
+			/// @details With several sessions, they are initialized on the thread pool and indexed,
+			/// published and announced together when all of them are ready or the init-timeout expires
+			/// (see completed()).
+			/// @param sids The ids of the new sessions.
+			/// @param event The event to emit for the new sessions after the initial load.
+			/// @return The batch being initialized on the thread pool (nullptr if the sessions are ready).
+			std::shared_ptr<Batch> insert(const std::vector<const char *> &sids, const Event event);
+
+			/// @brief Sessions being initialized on the thread pool, neither indexed nor published (requires the guard).
+			std::unordered_map<std::string, std::shared_ptr<Session>> initializing;
+
+			/// @brief The initial load is done, sessions initialized from now on emit their own event.
+			bool loaded = false;
+
+			/// @brief Index, publish and announce the initialized sessions of a batch.
+			/// @details Sessions still initializing are kept in 'initializing' and added by initialized().
+			void completed(Batch &batch) noexcept;
+
+			/// @brief A pool worker has finished a session after its batch was completed.
+			/// @param session The session.
+			/// @param event The event to emit if the initial load is already done.
+			/// @param success false if init() has failed.
+			void initialized(std::shared_ptr<Session> session, const Event event, bool success) noexcept;
+
+			/// @brief Resolve environment variables for several sessions with a single scan of /proc.
+			/// @param sessions The sessions to resolve.
+			/// @param varnames Names of the required variables.
+			void getenv(const std::vector<Session *> &sessions, const std::vector<std::string> &varnames);
+
 			std::thread *monitor = nullptr;
 
 			bool enabled = false;
 
+			/// @brief The sd-login monitor (only when neither the watcher nor the signals are in use).
+			sd_login_monitor *login_monitor = nullptr;
+
+			/// @brief Periodic consistency check (full rescan).
+			struct {
+				time_t interval = 0;		///< @brief Seconds between full rescans (0 to disable).
+				time_t next = 0;			///< @brief Time of the next full rescan.
+			} check;
+
+			/// @brief Timer fd for the main loop mode (-1 if not in use).
+			int tfd = -1;
+
+			/// @brief Monitor events waiting for the end of the coalescing window.
+			struct {
+				unsigned int window = 0;				///< @brief Coalescing window in milliseconds (0 to disable).
+				uint64_t deadline = 0;					///< @brief CLOCK_MONOTONIC time (ms) to apply the changes, 0 if none.
+				bool full = false;						///< @brief A full refresh is required.
+				std::set<std::string> changed;			///< @brief Created or modified session records.
+				std::set<std::string> deleted;			///< @brief Removed session records.
+			} pending;
+
+			/// @brief Apply the pending changes if the coalescing window has expired.
+			void flush() noexcept;
+
+			class Handler;
+			std::vector<std::shared_ptr<Handler>> handlers;	///< @brief Main loop handlers (empty when using the monitor thread).
+
+			/// @brief Load the current sessions, prepare the monitors.
+			void start();
+
+			/// @brief Release the monitors, unload sessions.
+			void stop() noexcept;
+
+			/// @brief Register the monitor descriptors on the udjat main loop.
+			void watch();
+
+			/// @brief Set the main loop timer from timeout().
+			void rearm() noexcept;
+
+			/// @brief Get the time to wait for the next check, in milliseconds (-1 if none).
+			int timeout() noexcept;
+
+			/// @brief The sd-login monitor has events.
+			void on_login_monitor() noexcept;
+
+			/// @brief The session records watcher has events.
+			void on_session_records() noexcept;
+
+			/// @brief Schedule a full refresh if the logind connection was reopened.
+			void on_reconnect() noexcept;
+
+			/// @brief Drain the wake-up eventfd.
+			void on_wakeup() noexcept;
+
+			/// @brief Run the consistency check if it's due.
+			void on_timer() noexcept;
+
 			/// @brief Event fd
 			int efd = -1;
 
@@ -81,6 +240,29 @@
 			class Bus;
 			std::shared_ptr<Bus> systembus;		///< @brief Connection with the system bus
 
+			class LoginD;
+			std::shared_ptr<LoginD> logind;		///< @brief Persistent sd-bus connection with logind
+
+			class Watcher;
+			std::shared_ptr<Watcher> watcher;	///< @brief inotify watcher for the logind session records.
+
+			/// @brief Update only the changed sessions.
+			/// @param changed Ids of the created or modified session records.
+			/// @param deleted Ids of the removed session records.
+			void refresh(const std::set<std::string> &changed, const std::set<std::string> &deleted) noexcept;
+
+			/// @brief Emit logoff, deinitialize and release session (requires the guard, the caller publishes the list).
+			void erase(Session *session) noexcept;
+
+			/// @brief Dispatch logind signals, update session hints.
+			void dispatch() noexcept;
+
+			/// @brief Session lifecycle is driven by logind SessionNew/SessionRemoved signals.
+			bool signal_driven = false;
+
+			/// @brief D-Bus paths from SessionNew signals, consumed by insert().
+			std::unordered_map<std::string, std::string> announced;
+
 #endif // _WIN32
 
 			/// @brief System is going to sleep.
@@ -95,6 +277,13 @@
 			/// @brief Update session list from system.
 			void refresh() noexcept;
 
+			/// @brief Refresh statistics.
+			struct {
+				std::atomic<unsigned int> requests{0};	///< @brief Change notifications received from the system.
+				std::atomic<unsigned int> full{0};		///< @brief Full session rescans.
+				std::atomic<unsigned int> partial{0};	///< @brief Refreshes of the changed sessions only.
+			} refreshes;
+
 			List();
 
 		public:
@@ -112,26 +301,61 @@
 			/// @brief Stop monitor, unload sessions.
 			void deactivate();
 
+			/// @brief Get the published session list (lock-free).
+			inline std::shared_ptr<const Snapshot> snapshot() const noexcept {
+				return std::atomic_load(&published);
+			}
+
+			/// @brief Get the sessions of an user (lock-free).
+			/// @param username The user name (case insensitive).
+			/// @return The user sessions, empty if the user has no session.
+			Snapshot by_name(const char *username) const;
+
+#ifndef _WIN32
+			/// @brief Get the sessions of an user id (lock-free).
+			/// @param uid The user id.
+			/// @return The user sessions, empty if the user has no session.
+			Snapshot by_uid(uid_t uid) const;
+#endif // !_WIN32
+
+			/// @brief Call the function on every published session (without locking the list).
 			bool for_each(const std::function<bool(User::Session &session)> &callback);
 
 			bool for_each(const std::function<bool(User::Agent &agent)> &callback);
 
+			/// @brief Find session by id.
+			/// @param id The session id.
+			/// @param callback Called with the session if found (with the list locked).
+			/// @return true if the session was found.
+			bool get(const std::string &id, const std::function<void(User::Session &session)> &callback);
+
 			inline size_t size() const {
-				return sessions.size();
+				return snapshot()->size();
 			}
 
-			inline auto begin() {
-				return sessions.begin();
-			}
+			/// @brief Get event dispatcher and refresh statistics.
+			Value & getProperties(Value &value) const;
 
-			inline auto end() {
-				return sessions.end();
+			/// @brief Get the lock state of the sessions in a single batch (without locking the list).
+			/// @param sessions The snapshot to query, keep it while using the result.
+			/// @return The lock state of every session, sessions failing the query are not in the map.
+			std::unordered_map<const Session *, bool> locked(const Snapshot &sessions);
+
+			/// @brief Check if any agent is handling the event.
+			inline bool handles(const Event event) const noexcept {
+				return (events & event) != 0;
 			}
 
 			void push_back(User::Agent *agent);
 			void remove(User::Agent *agent);
 
-			void push_back(User::Session *session);
+			/// @brief Agent alerts have changed, update the event mask.
+			void update(User::Agent *agent);
+
+			/// @brief Take ownership of a new (initialized) session.
+			void push_back(std::shared_ptr<User::Session> session);
+
+			/// @brief Session is being destroyed (already unindexed by release()).
 			void remove(User::Session *session);
 		};
 
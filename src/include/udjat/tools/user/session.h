@@ -23,12 +23,18 @@
  #include <memory>
  #include <string>
  #include <mutex>
+ #include <atomic>
  #include <list>
+ #include <unordered_map>
  #include <thread>
  #include <functional>
  #include <udjat/tools/object.h>
  #include <ostream>
 
+ #ifndef _WIN32
+	#include <sys/types.h>
+ #endif // !_WIN32
+
  namespace Udjat {
 
 	namespace User {
@@ -53,6 +59,9 @@
 			shutdown		= 0x0400,		///< @brief System is shutting down.
 
 			pulse			= 0x0800,		///< @brief 'Pulse' event.
+
+			user_online		= 0x1000,		///< @brief First session of the user has started (or is active on startup).
+			user_offline	= 0x2000,		///< @brief Last session of the user has finished (not emitted on shutdown).
 		};
 
 		/// @brief Create an event id.
@@ -79,19 +88,47 @@
 		UDJAT_API State StateFactory(const char *statename);
 
 		/// @brief User session.
-		class UDJAT_API Session : public Udjat::Abstract::Object {
+		class UDJAT_API Session : public Udjat::Abstract::Object, public std::enable_shared_from_this<Session> {
+		public:
+
+			/// @brief Session attributes checked by the alert filters, fetched once per event.
+			struct Attributes {
+
+				enum : uint8_t {
+					system	= 0x01,		///< @brief It's a system session.
+					remote	= 0x02,		///< @brief It's a remote session.
+					active	= 0x04,		///< @brief Session is active.
+					locked	= 0x08,		///< @brief Session is locked (only set for active sessions).
+				};
+
+				bool valid = false;				///< @brief Attributes were loaded.
+				uint8_t flags = 0;				///< @brief Session flags.
+				const char *classname = "";		///< @brief Interned session class.
+				const char *service = "";		///< @brief Interned session service.
+
+			};
+
 		private:
 			friend class List;
 
 			struct {
 				State state = User::SessionInUnknownState;	///< @brief Current user state.
 				bool alive = false;							///< @brief True if the session is alive.
-				bool locked = false;						///< @brief True if the session is locked.
+				std::atomic<bool> locked{false};			///< @brief True if the session is locked (last emitted state).
+				bool online = false;						///< @brief Session is counted on the user sessions.
 #ifdef _WIN32
 				bool remote = false;						///< @brief True if the session is remote.
 				bool system = true;							///< @brief True if its a system session.
 #else
 				uint8_t remote = 0xFF;						///< @brief Remote state.
+				std::atomic<bool> idle{false};				///< @brief True if the session is idle (logind 'IdleHint').
+
+				/// @brief logind hints kept updated by the signals (-1 until received or fetched).
+				/// @details A fetch only sets an unknown hint, it never overwrites a value from a signal.
+				struct {
+					std::atomic<int8_t> locked{-1};			///< @brief logind 'LockedHint'.
+					std::atomic<int8_t> active{-1};			///< @brief logind 'Active'.
+				} hints;
 #endif // _WIN32
 			} flags;
 
@@ -107,10 +144,51 @@
 			uid_t uid = -1;						///< @brief Session user id.
 			const char * cname = nullptr;		///< @brief Session class.
 			const char * sname = nullptr;		///< @brief Session service.
+			const char * uname = nullptr;		///< @brief Interned user name.
+
+			class Names;
 
 			class Bus;
 			std::shared_ptr<Bus> userbus;		///< @brief Connection with the user's bus
 
+			/// @brief Environment values resolved by User::List, consumed on the first state update.
+			std::unordered_map<std::string,std::string> environment;
+
+			/// @brief Is the user bus required? (some alert handles lock/unlock on a graphical session).
+			bool wants_userbus() const;
+
+			/// @brief Open the user bus and watch the screensaver.
+			void open_userbus();
+
+			/// @brief Open the user bus on foreground (if required), close it on background or closing.
+			void update_userbus() noexcept;
+
+		public:
+
+			/// @brief Session record parsed from /run/systemd/sessions/<sid>.
+			struct Record {
+				dev_t dev = 0;					///< @brief Device of the record file.
+				ino_t ino = 0;					///< @brief Inode of the record file.
+				time_t mtime = 0;				///< @brief Modification time of the record file (seconds).
+				long mtime_nsec = 0;			///< @brief Modification time of the record file (nanoseconds).
+
+				std::string state;				///< @brief Session state (online, active, closing).
+				uid_t uid = -1;					///< @brief Session user id.
+				std::string type;				///< @brief Session type (tty, x11, wayland, ...).
+				std::string classname;			///< @brief Session class (user, greeter, ...).
+				std::string service;			///< @brief PAM service that registered the session.
+				std::string display;			///< @brief X11 display of the session.
+				bool remote = false;			///< @brief Is this a remote session?
+				pid_t leader = 0;				///< @brief PID of the session leader.
+				std::string seat;				///< @brief Seat of the session.
+				unsigned int vtnr = 0;			///< @brief Virtual terminal number.
+			};
+
+		private:
+
+			/// @brief The last loaded session record (use std::atomic_load/std::atomic_store).
+			mutable std::shared_ptr<const Record> sdrecord;
+
 #endif // _WIN32
 
 		protected:
@@ -120,16 +198,24 @@
 			/// @brief Notify event emission (dont call it directly).
 			virtual Session & onEvent(const Event &event) noexcept;
 
+			/// @brief Notify event emission with the attributes captured when it was emitted (dont call it directly).
+			virtual Session & onEvent(const Event &event, const Attributes &attributes) noexcept;
+
 			void init();
 			void deinit();
 
 		public:
 			Session();
+			Session(const Session &) = delete;
+			Session & operator=(const Session &) = delete;
 			virtual ~Session();
 
 			/// @brief Get session name or id.
 			std::string to_string() const noexcept override;
 
+			/// @brief Get the session id (logind sid or windows session id).
+			std::string id() const;
+
 			const char * name() const noexcept override;
 
 			const char * name(bool update) const noexcept;
@@ -166,6 +252,9 @@
 				return flags.alive;
 			}
 
+			/// @brief Get the attributes used by alert filters.
+			Attributes attributes() const noexcept;
+
 #ifdef _WIN32
 
 			/// @brief Get user's domain
@@ -175,6 +264,16 @@
 			/// @brief Get session's user id
 			int userid() const;
 
+			/// @brief Get the session record.
+			/// @param check If true reload the record when the file has changed, if false load it only once.
+			/// @return The session record, empty if it's not available.
+			std::shared_ptr<const Record> record(bool check = false) const;
+
+			/// @brief Is this session idle? (logind 'IdleHint').
+			inline bool idle() const noexcept {
+				return flags.idle;
+			}
+
 			/// @brief Get X11 display of the session.
 			std::string display() const;
 
@@ -193,7 +292,13 @@
 			/// @brief Get environment value from user session.
 			std::string getenv(const char *varname) const;
 
+			/// @brief Get the address of the user's session bus (DBUS_SESSION_BUS_ADDRESS).
+			/// @param scan When false, don't scan the process environments if the bus socket is not available.
+			/// @return The bus address or an empty string if not found.
+			std::string busaddress(bool scan = true) const;
+
 			/// @brief Execute function as user's effective id.
+			/// @details Only the effective id of the calling thread is changed.
 			static void call(const uid_t uid, const std::function<void()> exec);
 
 			/// @brief Execute function as user's effective id.
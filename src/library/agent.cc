@@ -26,6 +26,19 @@
  #include <udjat/agent/user.h>
  #include <udjat/tools/user/list.h>
  #include <udjat/alert/user.h>
+ #include <udjat/tools/timestamp.h>
+ #include <algorithm>
+ #include <cstdlib>
+ #include <cstring>
+ #include <functional>
+ #include <random>
+ #include <fstream>
+
+ #ifdef _WIN32
+	#include <windows.h>
+ #else
+	#include <unistd.h>
+ #endif // _WIN32
 
  using namespace std;
 
@@ -74,20 +87,155 @@
 
 	}
 
+	/// @brief Index of the 'pulse' event in the alert table.
+	static constexpr size_t pulse_index = 11;
+
+	static_assert((1 << pulse_index) == User::pulse, "Unexpected 'pulse' event value");
+
+	/// @brief Get a per host value, keeps hosts rebooted together from sharing the pulse phases.
+	static size_t host_seed() noexcept {
+
+		string id;
+
+#ifdef _WIN32
+		char name[MAX_COMPUTERNAME_LENGTH + 1];
+		DWORD length = sizeof(name);
+		if(GetComputerNameA(name,&length)) {
+			id.assign(name,length);
+		}
+#else
+		for(const char *filename : { "/etc/machine-id", "/var/lib/dbus/machine-id" }) {
+			ifstream file{filename};
+			if(getline(file,id) && !id.empty()) {
+				break;
+			}
+			id.clear();
+		}
+
+		if(id.empty()) {
+			char name[256];
+			if(!gethostname(name,sizeof(name))) {
+				name[sizeof(name)-1] = 0;
+				id = name;
+			}
+		}
+#endif // _WIN32
+
+		return std::hash<std::string>{}(id);
+
+	}
+
+	/// @brief Get the deterministic pulse phase of a session.
+	static size_t phase_of(const User::Session &session) noexcept {
+
+		static const size_t seed = host_seed();
+		size_t hash = seed;
+
+		try {
+
+			hash ^= std::hash<std::string>{}(session.id()) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+#ifndef _WIN32
+			hash ^= std::hash<int>{}(session.userid()) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+#endif // !_WIN32
+
+		} catch(const std::exception &e) {
+
+			// Called from onEvent(), a partial hash still spreads the pulses.
+			Logger::String{e.what()}.trace("users");
+
+		}
+
+		return hash;
+	}
+
+	void User::Agent::schedule(const std::string &sid, size_t phase, time_t from, bool activity) {
+
+		auto &scheduled = pulses.sessions[sid];
+
+		for(User::Alert *alert : alerts[pulse_index]) {
+			if(alert->timer() && !alert->batched()) {
+				scheduled.push_back(pulses.queue.emplace(alert->next(from,phase,activity),Pulse{sid,alert,phase}));
+			}
+		}
+
+		if(scheduled.empty()) {
+			pulses.sessions.erase(sid);
+		}
+
+	}
+
+	void User::Agent::unschedule(const std::string &sid) {
+
+		auto it = pulses.sessions.find(sid);
+		if(it == pulses.sessions.end()) {
+			return;
+		}
+
+		for(auto &entry : it->second) {
+			pulses.queue.erase(entry);
+		}
+
+		pulses.sessions.erase(it);
+
+	}
+
+	time_t User::Agent::next() const noexcept {
+		if(pulses.queue.empty()) {
+			return 0;
+		}
+		return pulses.queue.begin()->first;
+	}
+
 	bool User::Agent::onEvent(Session &session, const Udjat::User::Event event) noexcept {
 
+		if(!handles(event)) {
+			return false;
+		}
+
+		return onEvent(session,event,session.attributes());
+	}
+
+	bool User::Agent::onEvent(Session &session, const Udjat::User::Event event, const Session::Attributes &attributes) noexcept {
+
 		bool activated = false;
 
+		if(!handles(event)) {
+			return false;
+		}
+
 		session.info() << "Event: " << event << endl;
 
-		for(User::Alert &alert : proxies) {
+		uint16_t bits = (uint16_t) event;
+		if(!(bits & (bits-1))) {
+
+			// Single event, check only the alerts subscribed to it.
+			size_t ix = 0;
+			while(!(bits & 1)) {
+				bits >>= 1;
+				ix++;
+			}
+
+			for(User::Alert *alert : alerts[ix]) {
+
+				if(alert->test(attributes)) {
+					activated = true;
+					alert->activate(*this,session);
+				}
+
+			}
+
+		} else {
+
+			for(User::Alert &alert : proxies) {
 
-			if(alert.test(event) && alert.test(session)) {
+				if(alert.test(event) && alert.test(attributes)) {
 
-				// Emit alert.
+					// Emit alert.
 
-				activated = true;
-				alert.activate(*this,session);
+					activated = true;
+					alert.activate(*this,session);
+
+				}
 
 			}
 
@@ -95,7 +243,30 @@
 
 		if(activated) {
 			alert_timestamp = time(0);
-			sched_update(timer()); // Reset timer for pulse event.
+		}
+
+		if(alerts[pulse_index].empty()) {
+			return activated;
+		}
+
+		// Update the pulse deadlines of this session only.
+		time_t next = 0;
+		{
+			lock_guard<mutex> lock(pulses.guard);
+
+			if(event & (User::logoff|User::still_active)) {
+				unschedule(session.id());
+			} else if(activated || (event & (User::logon|User::already_active))) {
+				unschedule(session.id());
+				schedule(session.id(),phase_of(session),time(0),true);
+			}
+
+			next = this->next();
+		}
+
+		if(next) {
+			time_t now = time(0);
+			sched_update(std::min((time_t) timers.max_pulse_check,(next > now ? next-now : 1)));
 		}
 
 		return activated;
@@ -114,6 +285,21 @@
 
 		User::Alert &proxy = proxies.back();
 
+		// Index alert by event.
+		for(size_t ix = 0; ix < (sizeof(alerts)/sizeof(alerts[0])); ix++) {
+			if(proxy.events() & (1 << ix)) {
+				alerts[ix].push_back(&proxy);
+			}
+		}
+		mask |= proxy.events();
+
+		if(proxy.test(User::pulse)) {
+			// Pulses are scheduled from the session lifecycle events.
+			mask |= (User::logon|User::already_active|User::logoff|User::still_active);
+		}
+
+		User::List::getInstance().update(this);
+
 		if(proxy.test(User::pulse)) {
 
 			auto timer = this->timer();
@@ -148,12 +334,20 @@
 
 		report.start("username","state","locked","remote","system","domain","display","type","service","class","activity","pulsetime",nullptr);
 
-		User::List::getInstance().for_each([this,&report](Udjat::User::Session &user) {
+		auto sessions = User::List::getInstance().snapshot();
+
+		auto locked = User::List::getInstance().locked(*sessions);
+
+		for(auto &session : *sessions) {
+
+			const User::Session &user = *session;
 
 			report.push_back(user.name());
 
 			report.push_back(user.state());
-			report.push_back(user.locked());
+
+			auto hint = locked.find(&user);
+			report.push_back(hint != locked.end() && hint->second);
 			report.push_back(user.remote());
 			report.push_back(user.system());
 #ifdef _WIN32
@@ -170,35 +364,28 @@
 			report.push_back(user.classname());
 #endif // _WIN32
 
-			/*
-			FIXME: Get pulse time
 			{
 				time_t pulse = 0;
 
-				for(const User::Alert &alert : proxies) {
-					time_t timer = alert.timer();
-					time_t next = alerttime + timer;
-					if(timer && alert.test(User::pulse) && alert.test(*session) && next > time(0)) {
-						if(pulse) {
-							pulse = std::min(pulse,next);
-						} else {
-							pulse = next;
+				lock_guard<mutex> lock(pulses.guard);
+				auto scheduled = pulses.sessions.find(user.id());
+				if(scheduled != pulses.sessions.end()) {
+					for(auto &entry : scheduled->second) {
+						if(!pulse || entry->first < pulse) {
+							pulse = entry->first;
 						}
 					}
 				}
 
 				if(pulse) {
-					report << TimeStamp(pulse);
+					report.push_back(TimeStamp(pulse));
 				} else {
-					report << "";
+					report.push_back("");
 				}
 
 			}
-			*/
-			report.push_back("");
-			return false;
 
-		});
+		}
 
 		return true;
 	}
@@ -209,41 +396,140 @@
 		Logger::String("Checking for updates").write(Logger::Debug,name());
 #endif // DEBUG
 
-		time_t required_wait = timers.max_pulse_check;
-		User::List::getInstance().for_each([this,&required_wait](Udjat::User::Session &session) {
+		if(alerts[pulse_index].empty()) {
+			return false;
+		}
 
-			time_t idletime = time(0) - alert_timestamp;	// Get time since last alert.
+		time_t now = time(0);
 
-			for(User::Alert &alert : proxies) {
+		if(!pulses.loaded) {
 
-				auto timer = alert.timer();	// Get alert timer.
+			// First check, schedule pulses for the sessions active before the agent.
+			vector<pair<string,size_t>> sids;
+			User::List::getInstance().for_each([&sids](Udjat::User::Session &session) {
+				sids.emplace_back(session.id(),phase_of(session));
+				return false;
+			});
 
-				if(timer && alert.test(User::pulse) && alert.test(session)) {
+			lock_guard<mutex> lock(pulses.guard);
+			for(auto &sid : sids) {
+				if(pulses.sessions.find(sid.first) == pulses.sessions.end()) {
+					schedule(sid.first,sid.second,now,false);
+				}
+			}
 
-					// Check for pulse.
-					if(timer <= idletime) {
+			// Batched alerts are scheduled once, with an empty session id and a random
+			// phase (the sessions are the same on every host after a mass reboot).
+			std::random_device random;
+			for(User::Alert *alert : alerts[pulse_index]) {
+				if(alert->batched() && alert->timer()) {
+					size_t phase = (size_t) random();
+					pulses.sessions[""].push_back(pulses.queue.emplace(alert->next(now,phase,false),Pulse{"",alert,phase}));
+				}
+			}
 
-						Logger::String{"Emitting PULSE (idletime=",idletime," alert-timer=",alert.timer(),")"}.write(Logger::Debug,name());
+			pulses.loaded = true;
 
-						alert.activate(*this,session);
+		}
 
-						required_wait = std::min(required_wait,timer);
-						Logger::String{"Will wait for ",timer," seconds"}.write(Logger::Debug,name());
+		// Get the expired pulses.
+		vector<Pulse> due;
+		{
+			lock_guard<mutex> lock(pulses.guard);
 
-					} else {
+			while(!pulses.queue.empty() && pulses.queue.begin()->first <= now) {
 
-						time_t seconds{timer - idletime};
-						required_wait = std::min(required_wait,seconds);
-						Logger::String{"Will wait for ",seconds," seconds"}.write(Logger::Debug,name());
+				auto entry = pulses.queue.begin();
 
+				auto scheduled = pulses.sessions.find(entry->second.sid);
+				if(scheduled != pulses.sessions.end()) {
+					auto &entries = scheduled->second;
+					entries.erase(std::remove(entries.begin(),entries.end(),entry),entries.end());
+					if(entries.empty()) {
+						pulses.sessions.erase(scheduled);
 					}
+				}
+
+				due.push_back(entry->second);
+				pulses.queue.erase(entry);
+
+			}
+
+		}
 
+		// Reschedule the pulse unless onEvent() already did it for the same session and alert.
+		auto reschedule = [this,now](const Pulse &pulse) {
+
+			lock_guard<mutex> lock(pulses.guard);
+
+			auto &scheduled = pulses.sessions[pulse.sid];
+			for(auto &entry : scheduled) {
+				if(entry->second.alert == pulse.alert) {
+					return;
+				}
+			}
+
+			scheduled.push_back(pulses.queue.emplace(pulse.alert->next(now,pulse.phase,false),pulse));
+
+		};
+
+		// Emit them without holding the pulse guard or the list guard.
+		auto snapshot = User::List::getInstance().snapshot();
+		unordered_map<string, std::shared_ptr<User::Session>> by_sid;
+
+		for(Pulse &pulse : due) {
+
+			if(pulse.sid.empty()) {
+
+				// Batched alert, a single activation with all the matching sessions.
+				User::List::Snapshot sessions;
+				for(auto &session : *snapshot) {
+					if(pulse.alert->test(session->attributes())) {
+						sessions.push_back(session);
+					}
 				}
 
+				if(!sessions.empty()) {
+					Logger::String{"Emitting PULSE for ",sessions.size()," session(s) (alert-timer=",pulse.alert->timer(),")"}.write(Logger::Debug,name());
+					pulse.alert->activate(*this,sessions);
+					alert_timestamp = time(0);
+				}
+
+				reschedule(pulse);
+				continue;
+
 			}
 
-			return false;
-		});
+			if(by_sid.empty()) {
+				for(auto &session : *snapshot) {
+					by_sid[session->id()] = session;
+				}
+			}
+
+			auto session = by_sid.find(pulse.sid);
+			if(session == by_sid.end()) {
+				// Logged off, not rescheduled.
+				continue;
+			}
+
+			if(pulse.alert->test(session->second->attributes())) {
+				Logger::String{"Emitting PULSE for session ",pulse.sid," (alert-timer=",pulse.alert->timer(),")"}.write(Logger::Debug,name());
+				pulse.alert->activate(*this,*session->second);
+				alert_timestamp = time(0);
+			}
+
+			reschedule(pulse);
+
+		}
+
+		time_t required_wait = timers.max_pulse_check;
+		{
+			lock_guard<mutex> lock(pulses.guard);
+			time_t next = this->next();
+			if(next) {
+				required_wait = std::min(required_wait,(next > now ? next-now : 1));
+			}
+		}
 
 		if(required_wait) {
 			this->timer(required_wait);
@@ -256,6 +542,8 @@
 	Value & User::Agent::getProperties(Value &value) const {
 		super::getProperties(value);
 
+		User::List::getInstance().getProperties(value);
+
 		Udjat::Value &users = value["users"];
 
 		User::List::getInstance().for_each([this,&users](Udjat::User::Session &user) {
@@ -273,16 +561,21 @@
 		}
 
 		debug("Searching for user '",path,"'");
-		for(auto user : User::List::getInstance()) {
+		auto sessions = User::List::getInstance().by_name(path);
 
-			if(!strcasecmp(user->name(),path)) {
-				user->getProperties(value);
-				return true;
-			}
+#ifndef _WIN32
+		if(sessions.empty() && *path && strspn(path,"0123456789") == strlen(path)) {
+			// Numeric path, search by uid.
+			sessions = User::List::getInstance().by_uid((uid_t) strtoul(path,nullptr,10));
+		}
+#endif // !_WIN32
 
+		if(sessions.empty()) {
+			return false;
 		}
 
-		return false;
+		sessions.front()->getProperties(value);
+		return true;
 	}
 
  }
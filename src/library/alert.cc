@@ -20,13 +20,28 @@
  #include <udjat/tools/object.h>
  #include <udjat/tools/logger.h>
  #include <udjat/tools/activatable.h>
+ #include <udjat/tools/quark.h>
  #include <udjat/alert/user.h>
  #include <udjat/agent/user.h>
  #include <iostream>
+ #include <cctype>
+ #include <cstring>
+ #include <algorithm>
+ #include <random>
 
  using namespace Udjat;
  using namespace std;
 
+#ifndef _WIN32
+ static const char * intern(const char *value) {
+	string str{value};
+	for(char &chr : str) {
+		chr = tolower(chr);
+	}
+	return Quark{str.c_str()}.c_str();
+ }
+#endif // !_WIN32
+
  Udjat::User::Alert::Alert(const XML::Node &node, std::shared_ptr<Activatable> a)
 		 : event{User::EventFactory(node)}, alert{a} {
 
@@ -43,6 +58,12 @@
 			throw runtime_error("Pulse alert requires the 'interval' attribute");
 		}
 
+		emit.batch = Object::getAttribute(node,group,"batch",emit.batch);
+		emit.spread = Object::getAttribute(node,group,"spread",emit.spread);
+
+		// Keep the jitter below the interval, the pulses would skip a phase.
+		emit.jitter = std::min((time_t) Object::getAttribute(node,group,"jitter",(unsigned int) 0), emit.timer/2);
+
 	} else {
 
 		emit.timer = 0;
@@ -79,8 +100,56 @@
 #ifndef _WIN32
 	emit.classname = Object::getAttribute(node,group,"session-class",emit.classname);
 	emit.service = Object::getAttribute(node,group,"session-service",emit.service);
+
+	// Intern filters in lowercase (as the session ones), sessions are matched by pointer.
+	if(emit.classname && *emit.classname) {
+		emit.classname = intern(emit.classname);
+	}
+
+	if(emit.service && *emit.service) {
+		emit.service = intern(emit.service);
+	}
 #endif // !_WIN32
 
+	//
+	// Compile flags into a truth table indexed by the session attribute flags.
+	//
+	for(uint16_t flags = 0; flags < 16; flags++) {
+
+		if(!emit.system && (flags & Session::Attributes::system)) {
+			continue;
+		}
+
+		if(!emit.remote && (flags & Session::Attributes::remote)) {
+			continue;
+		}
+
+		if(flags & Session::Attributes::active) {
+
+			if(!emit.active) {
+				continue;
+			}
+
+			bool locked = (flags & Session::Attributes::locked);
+
+			if(!emit.locked && locked) {
+				continue;
+			}
+
+			if(!emit.unlocked && !locked) {
+				continue;
+			}
+
+		} else if(!emit.inactive) {
+
+			continue;
+
+		}
+
+		filter |= (1 << flags);
+
+	}
+
  }
 
  void Udjat::User::Alert::activate(const Agent &agent, const Session &session) {
@@ -100,73 +169,182 @@
 
  }
 
- bool Udjat::User::Alert::test(const Udjat::User::Session &session) const noexcept {
+ /// @brief Append string to JSON output as a quoted and escaped value.
+ static void json_string(std::string &json, const std::string &value) {
+
+	static const char *hex = "0123456789abcdef";
+
+	json += '"';
+	for(unsigned char chr : value) {
+		switch(chr) {
+		case '"':
+			json += "\\\"";
+			break;
+		case '\\':
+			json += "\\\\";
+			break;
+		case '\n':
+			json += "\\n";
+			break;
+		case '\r':
+			json += "\\r";
+			break;
+		case '\t':
+			json += "\\t";
+			break;
+		default:
+			if(chr < 0x20) {
+				json += "\\u00";
+				json += hex[chr >> 4];
+				json += hex[chr & 0x0F];
+			} else {
+				json += (char) chr;
+			}
+		}
+	}
+	json += '"';
 
-	try {
+ }
 
-		if(!emit.system && session.system()) {
-			Logger::String{"Denying alert '",alert->name(),"' by 'system' flag"}.write(Logger::Debug,session.name());
-			return false;
+ void Udjat::User::Alert::activate(const Agent &agent, const std::vector<std::shared_ptr<Session>> &sessions) {
+
+	// Session properties on the batch payload, the boolean ones are not quoted.
+	static const struct {
+		const char *key;
+		bool boolean;
+	} properties[] = {
+		{ "username",	false	},
+		{ "remote",		true	},
+		{ "locked",		true	},
+		{ "active",		true	},
+		{ "display",	false	},
+		{ "type",		false	},
+		{ "service",	false	},
+		{ "classname",	false	},
+		{ "path",		false	},
+#ifdef _WIN32
+		{ "domain",		false	},
+#endif // _WIN32
+	};
+
+	string json{"["};
+
+	for(auto &session : sessions) {
+
+		if(json.size() > 1) {
+			json += ",";
 		}
 
-		if(!emit.remote && session.remote()) {
-			Logger::String{"Denying alert '",alert->name(),"' by 'remote' flag"}.write(Logger::Debug,session.name());
-			return false;
-		}
+		json += "{\"id\":";
+		json_string(json,session->id());
 
-		if(session.active()) {
+		for(auto &property : properties) {
 
-			if(!emit.active) {
-				Logger::String{"Denying alert '",alert->name(),"' by 'active' flag"}.write(Logger::Debug,session.name());
-				return false;
+			string value;
+			if(!session->getProperty(property.key,value)) {
+				continue;
 			}
 
-			bool locked = session.locked();
+			json += ",\"";
+			json += property.key;
+			json += "\":";
 
-			if(!emit.locked && locked) {
-				Logger::String{"Denying alert '",alert->name(),"' by 'locked' flag"}.write(Logger::Debug,session.name());
-				return false;
+			if(property.boolean) {
+				json += (value == "true" ? "true" : "false");
+			} else {
+				json_string(json,value);
 			}
 
-			if(!emit.unlocked && !locked) {
-				Logger::String{"Denying alert '",alert->name(),"' by 'unlocked' flag"}.write(Logger::Debug,session.name());
-				return false;
-			}
+		}
 
-		} else if(!emit.inactive) {
+		json += "}";
+
+	}
+
+	json += "]";
 
-			Logger::String{"Denying alert '",alert->name(),"' by 'inactive' flag"}.write(Logger::Debug,session.name());
-			return false;
+	alert->activate([&agent,&sessions,&json](const char *key, std::string &value){
 
+		if(!strcasecmp(key,"sessions")) {
+			value = json;
+			return true;
 		}
 
-#ifndef _WIN32
-		if(emit.classname && *emit.classname && strcasecmp(emit.classname,session.classname())) {
-			Logger::String{"Denying alert '",alert->name(),"' by 'classname' flag"}.write(Logger::Debug,session.name());
-			return false;
+		if(!strcasecmp(key,"count")) {
+			value = std::to_string(sessions.size());
+			return true;
 		}
 
-		if(emit.service && *emit.service && strcasecmp(emit.service,session.service())) {
-			Logger::String{"Denying alert '",alert->name(),"' by 'service' flag"}.write(Logger::Debug,session.name());
-			return false;
+		if(agent.getProperty(key,value)) {
+			return true;
 		}
-#endif // !_WIN32
 
-		Logger::String{"Allowing alert '",alert->name(),"'"}.write(Logger::Debug,session.name());
-		return true;
+		return false;
+	});
+
+ }
+
+ time_t Udjat::User::Alert::next(time_t from, size_t phase, bool activity) const {
+
+	time_t timer = emit.timer;
+	time_t rc;
+
+	if(emit.spread && timer > 1) {
+
+		// First time after 'from' in the session phase.
+		time_t after = from + (activity ? timer/2 : 0) + 1;
+		time_t offset = (time_t) (phase % (size_t) timer);
+		rc = after + ((offset - (after % timer) + timer) % timer);
+
+	} else {
+
+		rc = from + timer;
 
-	} catch(const std::exception &e) {
+	}
+
+	if(emit.jitter) {
+		static thread_local std::minstd_rand engine{std::random_device{}()};
+		rc += (time_t) std::uniform_int_distribution<unsigned int>{0,(unsigned int) emit.jitter}(engine);
+	}
 
-		session.error() << "Error checking alert '" << alert->name() << "' flags: " << e.what() << endl;
+	return rc;
 
-	} catch(...) {
+ }
+
+ bool Udjat::User::Alert::test(const Udjat::User::Session &session) const noexcept {
 
-		session.error() << "Unexpected error checking alert '" << alert->name() << "' flags" << endl;
+	auto attributes = session.attributes();
+	bool rc = test(attributes);
 
+	if(Logger::enabled(Logger::Debug)) {
+		Logger::String{(rc ? "Allowing" : "Denying")," alert '",alert->name(),"'"}.write(Logger::Debug,session.name());
 	}
 
-	return false;
+	return rc;
 
  }
 
+ bool Udjat::User::Alert::test(const Udjat::User::Session::Attributes &attributes) const noexcept {
+
+	if(!attributes.valid) {
+		return false;
+	}
+
+	if(!(filter & (1 << attributes.flags))) {
+		return false;
+	}
+
+#ifndef _WIN32
+	if(emit.classname && *emit.classname && emit.classname != attributes.classname) {
+		return false;
+	}
+
+	if(emit.service && *emit.service && emit.service != attributes.service) {
+		return false;
+	}
+#endif // !_WIN32
+
+	return true;
+
+ }
 
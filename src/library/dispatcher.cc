@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2024 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ /**
+  * @brief Implements the asynchronous event dispatcher.
+  */
+
+ #include <config.h>
+ #include "private.h"
+ #include <udjat/tools/logger.h>
+ #include <iostream>
+
+ #ifndef _WIN32
+	#include <pthread.h>
+ #endif // !_WIN32
+
+ using namespace std;
+
+ namespace Udjat {
+
+	User::List::Dispatcher::Dispatcher(size_t l) : limit{l} {
+	}
+
+	User::List::Dispatcher::~Dispatcher() {
+
+		{
+			lock_guard<mutex> lock(guard);
+			enabled = false;
+		}
+		wakeup.notify_all();
+
+		if(thread) {
+			thread->join();
+			delete thread;
+			thread = nullptr;
+		}
+
+	}
+
+	bool User::List::Dispatcher::push(std::shared_ptr<Session> session, const Event event, const Session::Attributes &attributes) noexcept {
+
+		try {
+
+			unique_lock<mutex> lock(guard);
+
+			if(!enabled) {
+				return false;
+			}
+
+			if(queue.size() >= limit) {
+				counters.dropped++;
+				if(!overflow) {
+					// Warn once per overflow.
+					Logger::String{"Event queue is full (",limit," events), dropping '",std::to_string(event),"'"}.warning(session->name());
+					overflow = true;
+				}
+				return false;
+			}
+
+			queue.push_back(Entry{std::move(session),event,attributes});
+			counters.queued++;
+			if(queue.size() > counters.max_depth) {
+				counters.max_depth = queue.size();
+			}
+
+			if(!thread) {
+				thread = new std::thread([this](){
+#ifndef _WIN32
+					pthread_setname_np(pthread_self(),"user-events");
+#endif // !_WIN32
+					run();
+				});
+			}
+
+		} catch(const std::exception &e) {
+
+			Logger::String{"Error '",e.what(),"' queueing event"}.error("users");
+			return false;
+
+		}
+
+		wakeup.notify_one();
+		return true;
+
+	}
+
+	void User::List::Dispatcher::run() noexcept {
+
+		unique_lock<mutex> lock(guard);
+
+		while(enabled || !queue.empty()) {
+
+			if(queue.empty()) {
+				busy = false;
+				overflow = false;
+				idle.notify_all();
+				wakeup.wait(lock);
+				continue;
+			}
+
+			Entry entry{std::move(queue.front())};
+			queue.pop_front();
+			busy = true;
+
+			lock.unlock();
+
+			List::notify(*entry.session,entry.event,entry.attributes);
+			entry.session.reset();
+
+			lock.lock();
+			counters.dispatched++;
+
+		}
+
+		busy = false;
+		idle.notify_all();
+
+	}
+
+	void User::List::Dispatcher::flush() noexcept {
+
+		unique_lock<mutex> lock(guard);
+
+		if(!thread || thread->get_id() == this_thread::get_id()) {
+			return;
+		}
+
+		idle.wait(lock,[this]{
+			return queue.empty() && !busy;
+		});
+
+	}
+
+	Value & User::List::Dispatcher::getProperties(Value &value) {
+
+		lock_guard<mutex> lock(guard);
+
+		value["depth"] = (unsigned int) queue.size();
+		value["limit"] = (unsigned int) limit;
+		value["maxdepth"] = (unsigned int) counters.max_depth;
+		value["queued"] = (unsigned int) counters.queued;
+		value["dispatched"] = (unsigned int) counters.dispatched;
+		value["dropped"] = (unsigned int) counters.dropped;
+
+		return value;
+	}
+
+ }
+
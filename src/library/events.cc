@@ -45,6 +45,8 @@
 	{ Udjat::User::Event::resume,			N_( "resume" ),			N_( "Session is resuming from sleep" )		},
 	{ Udjat::User::Event::shutdown,			N_( "shutdown" ),		N_( "Session is shutting down" )			},
 	{ Udjat::User::Event::pulse,			N_( "pulse" ),			N_( "Session is alive" )					},
+	{ Udjat::User::Event::user_online,		N_( "user-online" ),	N_( "First session of the user" )			},
+	{ Udjat::User::Event::user_offline,		N_( "user-offline" ),	N_( "Last session of the user" )			},
  };
 
  namespace Udjat {
@@ -18,11 +18,21 @@
  */
 
  #include <config.h>
+ #include "private.h"
  #include <udjat/tools/user/session.h>
  #include <udjat/tools/user/list.h>
+ #include <udjat/agent/user.h>
+ #include <udjat/tools/configuration.h>
+ #include <udjat/tools/logger.h>
 
  #include <cstring>
+ #include <cctype>
  #include <iostream>
+ #include <memory>
+
+ #ifndef _WIN32
+	#include "os/linux/private.h"
+ #endif // _WIN32
 
  using namespace std;
 
@@ -36,7 +46,14 @@
 	void User::List::init() noexcept {
 
 		lock_guard<recursive_mutex> lock(guard);
-		for(auto session : sessions) {
+
+		if(!dispatcher) {
+			size_t limit = Config::Value<unsigned int>("user-session","event-queue-size",4096);
+			if(limit) {
+				dispatcher = make_shared<Dispatcher>(limit);
+			}
+		}
+		for(auto &session : sessions) {
 			cout << "users\tInitializing session @" << session->sid << endl;
 			session->flags.alive = true;
 			session->emit(already_active);
@@ -46,22 +63,36 @@
 
 	void User::List::deinit() noexcept {
 
-		lock_guard<recursive_mutex> lock(guard);
+		std::shared_ptr<Dispatcher> dispatcher;
 
-		while(!sessions.empty()) {
+		{
+			lock_guard<recursive_mutex> lock(guard);
 
-			Session *session = *sessions.begin();
-			Logger::String{"Deinitializing session @",session->sid}.trace("userlist");
-			if(session->flags.alive) {
-				session->emit(still_active);
-				session->flags.alive = false;
+			while(!sessions.empty()) {
+
+				Session *session = sessions.begin()->get();
+				Logger::String{"Deinitializing session @",session->sid}.trace("userlist");
+				if(session->flags.alive) {
+					session->emit(still_active);
+					session->flags.alive = false;
+				}
+				session->flags.online = false;
+				session->deinit();
+				release(session);
 			}
-			session->deinit();
-			delete session;
+
+			online.clear();
+			publish();
+			dispatcher = this->dispatcher;
+		}
+
+		// Deliver the 'still active' events before returning, never with the guard held.
+		if(dispatcher) {
+			dispatcher->flush();
 		}
 
 		/*
-		for(auto session : sessions) {
+		for(auto &session : sessions) {
 
 			cout << *session << "\tDeinitializing session @" << session->sid << endl;
 
@@ -80,28 +111,143 @@
 	}
 
 	void User::List::push_back(User::Agent *agent) {
-		lock_guard<recursive_mutex> lock(guard);
+		lock_guard<recursive_mutex> lock(agentguard);
 		agents.push_back(agent);
+		update(agent);
 	}
 
 	void User::List::remove(User::Agent *agent) {
-		lock_guard<recursive_mutex> lock(guard);
+		lock_guard<recursive_mutex> lock(agentguard);
 		agents.remove(agent);
+		update(agent);
 	}
 
-	void User::List::push_back(User::Session *session) {
+	void User::List::update(User::Agent *) {
+
+		lock_guard<recursive_mutex> lock(agentguard);
+
+		uint16_t mask = 0;
+		for(User::Agent *agent : agents) {
+			for(uint16_t bit = 1; bit; bit <<= 1) {
+				if(agent->handles((Event) bit)) {
+					mask |= bit;
+				}
+			}
+		}
+
+		events = mask;
+
+	}
+
+	void User::List::push_back(std::shared_ptr<User::Session> session) {
 		lock_guard<recursive_mutex> lock(guard);
 		sessions.push_back(session);
+#ifndef _WIN32
+		index[session->sid] = std::prev(sessions.end());
+#endif // !_WIN32
 	}
 
 	void User::List::remove(User::Session *session) {
+
+		// Sessions are owned by the list, the published snapshots and the event queue; when
+		// this is called the session was already unindexed by release(). Don't take the guard,
+		// the last reference can be dropped by the dispatcher thread.
+		(void) session;
+
+	}
+
+	void User::List::release(User::Session *session) {
+
 		lock_guard<recursive_mutex> lock(guard);
-		sessions.remove(session);
+
+		// Released without logoff (disconnected session), it's no longer counted.
+		if(session->flags.online) {
+			count(*session,logoff);
+		}
+
+		// The published snapshot keeps a reference until the next publish().
+#ifndef _WIN32
+		auto it = index.find(session->sid);
+		if(it != index.end() && it->second->get() == session) {
+			sessions.erase(it->second);
+			index.erase(it);
+		}
+#else
+		for(auto entry = sessions.begin(); entry != sessions.end(); entry++) {
+			if(entry->get() == session) {
+				sessions.erase(entry);
+				break;
+			}
+		}
+#endif // !_WIN32
+
 	}
 
-	bool User::List::for_each(const std::function<bool(Session &session)> &callback) {
+	void User::List::publish() {
+
 		lock_guard<recursive_mutex> lock(guard);
-		for(auto session : sessions) {
+
+		auto snapshot = make_shared<Snapshot>();
+		snapshot->reserve(sessions.size());
+		for(auto &session : sessions) {
+			snapshot->push_back(session);
+		}
+
+		// Rebuild the user indexes, the names are already resolved on session init.
+		auto indexes = make_shared<Users>();
+		for(auto &session : sessions) {
+
+			string name{session->name()};
+			for(char &chr : name) {
+				chr = tolower(chr);
+			}
+			indexes->names[name].push_back(session);
+
+#ifndef _WIN32
+			if(session->uid != (uid_t) -1) {
+				indexes->uids[session->uid].push_back(session);
+			}
+#endif // !_WIN32
+
+		}
+
+		std::atomic_store(&published,std::shared_ptr<const Snapshot>{snapshot});
+		std::atomic_store(&users,std::shared_ptr<const Users>{indexes});
+
+	}
+
+	User::List::Snapshot User::List::by_name(const char *username) const {
+
+		string name{username};
+		for(char &chr : name) {
+			chr = tolower(chr);
+		}
+
+		auto indexes = std::atomic_load(&users);
+		auto it = indexes->names.find(name);
+		if(it == indexes->names.end()) {
+			return Snapshot{};
+		}
+		return it->second;
+
+	}
+
+#ifndef _WIN32
+	User::List::Snapshot User::List::by_uid(uid_t uid) const {
+
+		auto indexes = std::atomic_load(&users);
+		auto it = indexes->uids.find(uid);
+		if(it == indexes->uids.end()) {
+			return Snapshot{};
+		}
+		return it->second;
+
+	}
+#endif // !_WIN32
+
+	bool User::List::for_each(const std::function<bool(Session &session)> &callback) {
+		auto snapshot = this->snapshot();
+		for(auto &session : *snapshot) {
 			if(callback(*session)) {
 				return true;
 			}
@@ -110,7 +256,7 @@
 	}
 
 	bool User::List::for_each(const std::function<bool(User::Agent &agent)> &callback) {
-		lock_guard<recursive_mutex> lock(guard);
+		lock_guard<recursive_mutex> lock(agentguard);
 		for(User::Agent *agent : agents) {
 			if(callback(*agent)) {
 				return true;
@@ -122,7 +268,7 @@
 	void User::List::sleep() {
 		cout << "users\tSystem is preparing to sleep" << endl;
 		lock_guard<recursive_mutex> lock(guard);
-		for(auto session : sessions) {
+		for(auto &session : sessions) {
 			session->emit(User::sleep);
 		}
 	}
@@ -130,7 +276,7 @@
 	void User::List::resume() {
 		cout << "users\tSystem is resuming from sleep" << endl;
 		lock_guard<recursive_mutex> lock(guard);
-		for(auto session : sessions) {
+		for(auto &session : sessions) {
 			session->emit(User::resume);
 		}
 	}
@@ -138,9 +284,111 @@
 	void User::List::shutdown() {
 		cout << "users\tSystem is preparing to shutdown" << endl;
 		lock_guard<recursive_mutex> lock(guard);
-		for(auto session : sessions) {
+		for(auto &session : sessions) {
 			session->emit(User::shutdown);
 		}
 	}
 
+	void User::List::emit(Session &session, const Event event) noexcept {
+
+		send(session,event);
+
+		// Sessions still active on shutdown are not offline, the daemon is just stopping.
+		if(event & (logon|already_active|logoff)) {
+			count(session,event);
+		}
+
+	}
+
+	void User::List::count(Session &session, const Event event) noexcept {
+
+		lock_guard<recursive_mutex> lock(guard);
+
+#ifdef _WIN32
+		std::string key{session.to_string()};
+#else
+		// Use the uid cached on init, userid() can throw.
+		uid_t key = session.uid;
+		if(key == (uid_t) -1) {
+			return;
+		}
+#endif // _WIN32
+
+		if(event & (logon|already_active)) {
+
+			if(session.flags.online) {
+				return;
+			}
+
+			session.flags.online = true;
+			if(++online[key] == 1) {
+				send(session,user_online);
+			}
+
+		} else if(session.flags.online) {
+
+			session.flags.online = false;
+
+			auto it = online.find(key);
+			if(it == online.end()) {
+				return;
+			}
+
+			if(--it->second == 0) {
+				online.erase(it);
+				send(session,user_offline);
+			}
+
+		}
+
+	}
+
+	void User::List::send(Session &session, const Event event) noexcept {
+
+		if(!handles(event)) {
+			// No agent is listening, don't even queue it.
+			return;
+		}
+
+		// Capture the attributes now, the filters must see the state at this event, not at delivery.
+		Session::Attributes attributes{session.attributes()};
+
+		if(dispatcher) {
+
+			// Queue a reference, not a copy; the session lives until the event is delivered.
+			auto reference = session.weak_from_this().lock();
+			if(reference) {
+				dispatcher->push(reference,event,attributes);
+				return;
+			}
+
+		}
+
+		notify(session,event,attributes);
+
+	}
+
+	void User::List::notify(Session &session, const Event event, const Session::Attributes &attributes) noexcept {
+		session.onEvent(event,attributes);
+	}
+
+	Value & User::List::getProperties(Value &value) const {
+
+		if(dispatcher) {
+			dispatcher->getProperties(value["events"]);
+		}
+
+		Value &refresh = value["refresh"];
+		refresh["requests"] = (unsigned int) refreshes.requests;
+		refresh["full"] = (unsigned int) refreshes.full;
+		refresh["partial"] = (unsigned int) refreshes.partial;
+
+#ifndef _WIN32
+		Session::Bus::Dispatcher::getInstance().getProperties(value["userbus"]);
+		Session::Names::getInstance().getProperties(value["usernames"]);
+#endif // _WIN32
+
+		return value;
+	}
+
  }
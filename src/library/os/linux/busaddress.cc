@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2024 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ /**
+  * @brief Resolve the user's session bus address.
+  */
+
+ #include <config.h>
+ #include <udjat/tools/user/session.h>
+ #include <udjat/tools/logger.h>
+ #include <sys/stat.h>
+ #include <cstring>
+ #include <fstream>
+ #include <mutex>
+ #include <unordered_map>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	/// @brief Bus sockets already found, by uid.
+	static struct {
+		std::mutex guard;
+		std::unordered_map<uid_t, std::string> paths;
+	} sockets;
+
+	/// @brief Get the user's runtime directory from the logind user record.
+	static string runtime_dir(uid_t uid) {
+
+		ifstream file{string{"/run/systemd/users/"} + std::to_string(uid)};
+
+		string line;
+		while(getline(file,line)) {
+			if(!strncmp(line.c_str(),"RUNTIME=",8)) {
+				return line.substr(8);
+			}
+		}
+
+		return string{"/run/user/"} + std::to_string(uid);
+
+	}
+
+	static bool is_socket(const std::string &path) noexcept {
+		struct stat st;
+		return stat(path.c_str(),&st) == 0 && S_ISSOCK(st.st_mode);
+	}
+
+	std::string User::Session::busaddress(bool scan) const {
+
+		uid_t uid = (uid_t) userid();
+
+		if(uid != (uid_t) -1) {
+
+			string path;
+
+			{
+				lock_guard<mutex> lock(sockets.guard);
+				auto it = sockets.paths.find(uid);
+				if(it != sockets.paths.end()) {
+					path = it->second;
+				}
+			}
+
+			if(path.empty() || !is_socket(path)) {
+
+				// Not cached or gone with the user manager, check the runtime directory.
+				path = runtime_dir(uid) + "/bus";
+
+				lock_guard<mutex> lock(sockets.guard);
+				if(is_socket(path)) {
+					sockets.paths[uid] = path;
+				} else {
+					sockets.paths.erase(uid);
+					path.clear();
+				}
+
+			}
+
+			if(!path.empty()) {
+				return string{"unix:path="} + path;
+			}
+
+		}
+
+		if(!scan) {
+			return "";
+		}
+
+		// No systemd user bus, the address is specific to the session (dbus-launch), search it.
+		Logger::String{"No user bus socket, scanning process environments"}.trace(name());
+		return getenv("DBUS_SESSION_BUS_ADDRESS");
+
+	}
+
+ }
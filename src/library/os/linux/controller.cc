@@ -39,8 +39,14 @@
  #include <signal.h>
  #include <udjat/tools/configuration.h>
  #include <udjat/tools/logger.h>
+ #include <udjat/version.h>
  #include <pthread.h>
  #include <sys/eventfd.h>
+ #include <unordered_set>
+ #include <udjat/tools/threadpool.h>
+ #include <condition_variable>
+ #include <chrono>
+ #include <thread>
 
  #include "private.h"
 
@@ -56,75 +62,223 @@
 
  namespace Udjat {
 
+	struct User::List::Batch {
+
+		enum Status : uint8_t {
+			Pending,
+			Ready,
+			Failed
+		};
+
+		std::mutex guard;
+		std::condition_variable changed;
+
+		const std::vector<std::shared_ptr<Session>> sessions;
+		std::vector<Status> status;			///< @brief Initialization status of every session.
+		const Event event;						///< @brief Event to emit for the sessions after the initial load.
+		const time_t timeout;					///< @brief Seconds to wait for the sessions (0 to wait forever).
+
+		size_t next = 0;						///< @brief Next session to initialize.
+		size_t outstanding;						///< @brief Sessions not initialized yet.
+		bool closed = false;					///< @brief The batch was published by completed().
+
+		Batch(const std::vector<std::shared_ptr<Session>> &s, const Event e, time_t t)
+			: sessions{s}, status(s.size(),Pending), event{e}, timeout{t}, outstanding{s.size()} {
+		}
+
+	};
+
+	/// @brief Update session state from the session record (reloaded only if the file has changed).
+	static void refresh_state(User::Session &session) {
+
+		auto record = session.record(true);
+		if(record) {
+			session.set(User::StateFactory(record->state.c_str()));
+			return;
+		}
+
+		char *state = nullptr;
+		if(sd_session_get_state(session.id().c_str(), &state) >= 0) {
+			session.set(User::StateFactory(state));
+			free(state);
+		}
+
+	}
+
  	void User::List::refresh() noexcept {
 
 		char **ids = nullptr;
 		int idCount = sd_get_sessions(&ids);
 
+		if(idCount < 0) {
+			Logger::String{"sd_get_sessions: ",strerror(-idCount)," (rc=",idCount,")"}.error("userlist");
+			return;
+		}
+
  #ifdef DEBUG
 		cout << "users\tRefreshing " << idCount << " sessions" << endl;
  #endif // DEBUG
 
 		lock_guard<recursive_mutex> lock(guard);
 
-		// Remove unused sessions.
-		vector<Session *> deleted;
+		refreshes.full++;
 
-		for_each([&deleted,ids,idCount](Session &session){
+		// Count the known sessions; since logind ids are unique, if all the
+		// indexed sessions were found there's nothing to remove.
+		size_t found = 0;
+		vector<const char *> added;
+		for(int id = 0; id < idCount; id++) {
+			if(index.find(ids[id]) != index.end()) {
+				found++;
+			} else {
+				added.push_back(ids[id]);
+			}
+		}
 
-			// Is the session in the list of active ones?
-			for(int id = 0; id < idCount; id++) {
-				if(!strcmp(session.sid.c_str(),ids[id])) {
-					return false;
+		if(found != index.size() || !initializing.empty()) {
+
+			// Remove unused sessions.
+			unordered_set<string> active{ids,ids+idCount};
+			vector<Session *> deleted;
+
+			for(auto &entry : index) {
+				if(!active.count(entry.first)) {
+					deleted.push_back(entry.second->get());
 				}
 			}
 
-			// Cant find it in the list, mark for removal.
-			deleted.push_back(&session);
+			if(!deleted.empty()) {
+				Logger::String{"Cleaning ",deleted.size()," unused session(s)"}.trace("Userlist");
+				for(auto session : deleted) {
+					erase(session);
+				}
+				publish();
+			}
 
-			return false;
-		});
+			// Sessions removed while initializing are dropped by initialized().
+			for(auto it = initializing.begin(); it != initializing.end();) {
+				if(active.count(it->first)) {
+					it++;
+				} else {
+					it = initializing.erase(it);
+				}
+			}
+
+		}
+
+		// Create new sessions.
+		if(!added.empty()) {
+			insert(added,logon);
+		}
+
+		// Update sessions (the ones still initializing are updated when ready).
+		for(int id = 0; id < idCount; id++) {
+
+			try {
 
-		if(!deleted.empty()) {
-			Logger::String{"Cleaning ",deleted.size()," unused session(s)"}.trace("Userlist");
-			for(auto session : deleted) {
-
-				// Reset states, just in case of some other one have an instance of this session.
-				if(session->flags.alive) {
-
-					if(Logger::enabled(Logger::Debug)) {
-						Logger::String{
-							"Sid=",session->sid,
-							" Uid=",session->userid(),
-							" System=",session->system(),
-							" type=",session->type(),
-							" display=",session->display(),
-							" remote=",session->remote(),
-							" service=",session->service(),
-							" class=",session->classname()
-						}.write(Logger::Debug,session->name());
+				auto it = index.find(ids[id]);
+				if(it != index.end()) {
+
+					Session &session = **it->second;
+					if(!session.flags.alive) {
+						session.flags.alive = true;
+						session.emit(logon);
 					}
-					session->emit(logoff);
-					session->flags.alive = false;
+
+					refresh_state(session);
+
 				}
 
-				session->deinit();
-				delete session;
+			} catch(const std::exception &e) {
+
+				Logger::String{e.what()}.error("userlist");
+
 			}
+
+			free(ids[id]);
 		}
 
-		/*
+		free(ids);
+
+	}
+
+	void User::List::start() {
+
+		{
+			char **ids = nullptr;
+			int idCount = sd_get_sessions(&ids);
+
+			std::shared_ptr<Batch> batch;
+			if(idCount > 0) {
+				lock_guard<recursive_mutex> lock(guard);
+				batch = insert(vector<const char *>{ids,ids+idCount},already_active);
+			}
+
+			// Don't report the list as loaded before the sessions are ready (or timed out).
+			if(batch) {
+				unique_lock<mutex> lock(batch->guard);
+				batch->changed.wait(lock,[&batch]{ return batch->closed; });
+			}
 
-		sessions.remove_if([ids,idCount](const shared_ptr<Session> &session) {
+			lock_guard<recursive_mutex> lock(guard);
 
 			for(int id = 0; id < idCount; id++) {
-				if(!strcmp(session->sid.c_str(),ids[id]))
-					return false;
+
+				try {
+
+					auto it = index.find(ids[id]);
+					if(it != index.end()) {
+						refresh_state(**it->second);
+					}
+
+				} catch(const std::exception &e) {
+
+					Logger::String{e.what()}.error("userlist");
+
+				}
+
+				free(ids[id]);
+			}
+
+			free(ids);
+
+			// Emit 'already active' for the loaded sessions, the ones still initializing will emit it when ready.
+			init();
+			loaded = true;
+
+		}
+
+		if(!signal_driven && !watcher) {
+			// Only session changes, seats and users are not relevant.
+			int rc = sd_login_monitor_new("session",&login_monitor);
+			if(rc < 0) {
+				login_monitor = nullptr;
+				Logger::String{"sd_login_monitor_new: ",strerror(-rc)}.error("userlist");
 			}
+		}
+
+		// With the session records or the logind signals watched, the full rescan is only a consistency check.
+		check.interval = Config::Value<unsigned int>("user-session","consistency-check-interval",300);
+		check.next = time(0) + check.interval;
+
+		// Collapse bursts of monitor events (mass logouts) into a single refresh.
+		pending.window = Config::Value<unsigned int>("user-session","refresh-coalesce-ms",200);
+		pending.deadline = 0;
+		pending.full = false;
+		pending.changed.clear();
+		pending.deleted.clear();
+
+	}
 
-			// Reset states, just in case of some other one have an instance of this session.
-			if(session->flags.alive) {
-				Logger::String(
+	void User::List::erase(Session *session) noexcept {
+
+		lock_guard<recursive_mutex> lock(guard);
+
+		// Reset states, just in case of some other one have an instance of this session.
+		if(session->flags.alive) {
+
+			if(Logger::enabled(Logger::Debug)) {
+				Logger::String{
 					"Sid=",session->sid,
 					" Uid=",session->userid(),
 					" System=",session->system(),
@@ -133,31 +287,68 @@
 					" remote=",session->remote(),
 					" service=",session->service(),
 					" class=",session->classname()
-				).write(Logger::Debug,session->name());
-				session->emit(logoff);
-				session->flags.alive = false;
+				}.write(Logger::Debug,session->name());
 			}
+			session->emit(logoff);
+			session->flags.alive = false;
+		}
 
-			deleted.push_back(session)delete session;
-			return true;
-		});
-		*/
+		session->deinit();
+		release(session);
 
-		// Create and update sessions.
-		for(int id = 0; id < idCount; id++) {
+	}
+
+	void User::List::refresh(const std::set<std::string> &changed, const std::set<std::string> &deleted) noexcept {
+
+		lock_guard<recursive_mutex> lock(guard);
+
+		refreshes.partial++;
+
+		bool removed = false;
+		for(const string &sid : deleted) {
+
+			auto it = index.find(sid);
+			if(it != index.end()) {
+				Logger::String{"Session record @",sid," was removed"}.trace("userlist");
+				erase(it->second->get());
+				removed = true;
+			}
+
+			// Still initializing, will be dropped by initialized().
+			initializing.erase(sid);
+
+		}
+
+		if(removed) {
+			publish();
+		}
+
+		vector<const char *> added;
+		for(const string &sid : changed) {
+			if(index.find(sid) == index.end()) {
+				added.push_back(sid.c_str());
+			}
+		}
+
+		if(!added.empty()) {
+			insert(added,logon);
+		}
+
+		for(const string &sid : changed) {
 
 			try {
 
-				auto session = find(ids[id]);
-				if(!session.flags.alive) {
-					session.flags.alive = true;
-					session.emit(logon);
-				}
+				auto it = index.find(sid);
+				if(it != index.end()) {
+
+					Session &session = **it->second;
+					if(!session.flags.alive) {
+						session.flags.alive = true;
+						session.emit(logon);
+					}
+
+					refresh_state(session);
 
-				char *state = nullptr;
-				if(sd_session_get_state(ids[id], &state) >= 0) {
-					session.set(User::StateFactory(state));
-					free(state);
 				}
 
 			} catch(const std::exception &e) {
@@ -166,38 +357,283 @@
 
 			}
 
-			free(ids[id]);
 		}
 
-		free(ids);
+	}
+
+	bool User::List::get(const std::string &id, const std::function<void(User::Session &session)> &callback) {
+
+		lock_guard<recursive_mutex> lock(guard);
+
+		auto it = index.find(id);
+		if(it == index.end()) {
+			return false;
+		}
+
+		callback(**it->second);
+		return true;
 
 	}
 
-	/// @brief Find session (Requires an active guard!!!)
-	User::Session & User::List::find(const char * sid) {
+	std::shared_ptr<User::List::Batch> User::List::insert(const std::vector<const char *> &sids, const Event event) {
 
 		lock_guard<recursive_mutex> lock(guard);
-		for(auto session : sessions) {
-			if(!strcmp(session->sid.c_str(),sid)) {
-				return *session;
+
+		vector<std::shared_ptr<Session>> created;
+		created.reserve(sids.size());
+
+		for(const char *sid : sids) {
+
+			if(index.find(sid) != index.end() || initializing.find(sid) != initializing.end()) {
+				continue;
+			}
+
+			auto session = make_shared<Session>();
+			session->sid = sid;
+			created.push_back(session);
+
+			// Got the path from SessionNew, no need to ask logind for it.
+			auto path = announced.find(session->sid);
+			if(path != announced.end()) {
+				session->dbpath = path->second;
+				announced.erase(path);
+			}
+		}
+
+		if(created.size() > 1 && Config::Value<bool>("user-session","open-session-bus",true) && handles((Event) (User::lock|User::unlock))) {
+
+			// Only the sessions without a systemd user bus socket need the environment.
+			vector<Session *> scan;
+			for(auto &session : created) {
+				if(session->busaddress(false).empty()) {
+					scan.push_back(session.get());
+				}
+			}
+
+			// Resolve the bus address of them with a single /proc scan.
+			if(scan.size() > 1) {
+				try {
+					getenv(scan,{"DBUS_SESSION_BUS_ADDRESS"});
+				} catch(const std::exception &e) {
+					Logger::String{"Error '",e.what(),"' scanning process environments"}.error("userlist");
+				}
 			}
+
 		}
 
-		// Not found, create a new one.
-		Session * session = new Session();
+		size_t parallel = Config::Value<unsigned int>("user-session","init-parallelism",8);
+
+		if(created.size() < 2 || parallel < 2) {
+
+			for(auto &session : created) {
+
+				try {
+
+					session->init();
+					push_back(session);
+
+				} catch(const std::exception &e) {
+
+					Logger::String{e.what()}.error("userlist");
+
+				}
+
+			}
+
+			publish();
+			return std::shared_ptr<Batch>();
+
+		}
+
+		// Initialize sessions on the thread pool, init() may block on /proc scans and user buses.
+		auto batch = make_shared<Batch>(created,event,(time_t) Config::Value<unsigned int>("user-session","init-timeout",60));
+
+		for(auto &session : created) {
+			initializing[session->sid] = session;
+		}
+
+		size_t workers = std::min(parallel,created.size());
+		for(size_t worker = 0; worker < workers; worker++) {
+
+			ThreadPool::getInstance().push("user-session-init",[batch](){
+
+				while(true) {
+
+					size_t ix;
+					{
+						lock_guard<mutex> lock(batch->guard);
+						if(batch->next >= batch->sessions.size()) {
+							return;
+						}
+						ix = batch->next++;
+					}
+
+					std::shared_ptr<Session> session = batch->sessions[ix];
+					bool success = true;
+
+					try {
+
+						session->init();
+
+					} catch(const std::exception &e) {
+
+						Logger::String{e.what()}.error("userlist");
+						success = false;
+
+					}
+
+					bool late = false;
+					{
+						lock_guard<mutex> lock(batch->guard);
+						batch->status[ix] = (success ? Batch::Ready : Batch::Failed);
+						batch->outstanding--;
+						late = batch->closed;
+					}
+
+					if(late) {
+						// The batch was already published without this session.
+						List::getInstance().initialized(session,batch->event,success);
+					} else {
+						batch->changed.notify_all();
+					}
+
+				}
+
+			});
+
+		}
+
+		// Publish the batch when all the sessions are ready or on init-timeout, without
+		// blocking a pool thread (the workers could be waiting for a free one).
+		std::thread([batch](){
+
+			pthread_setname_np(pthread_self(),"user-init");
+
+			{
+				unique_lock<mutex> lock(batch->guard);
+				auto ready = [&batch]{ return batch->outstanding == 0; };
+				if(batch->timeout) {
+					batch->changed.wait_for(lock,std::chrono::seconds(batch->timeout),ready);
+				} else {
+					batch->changed.wait(lock,ready);
+				}
+			}
+
+			List::getInstance().completed(*batch);
+
+		}).detach();
+
+		return batch;
+
+	}
+
+	void User::List::completed(Batch &batch) noexcept {
+
+		lock_guard<recursive_mutex> lock(guard);
+		lock_guard<mutex> block(batch.guard);
+
+		vector<std::shared_ptr<Session>> added;
+
+		for(size_t ix = 0; ix < batch.sessions.size(); ix++) {
+
+			const std::shared_ptr<Session> &session = batch.sessions[ix];
+
+			auto it = initializing.find(session->sid);
+			bool removed = (it == initializing.end() || it->second != session);
+
+			switch(batch.status[ix]) {
+			case Batch::Pending:
+				// Still running, initialized() will add it (or drop it if removed meanwhile).
+				if(!removed) {
+					Logger::String{"Session @",session->sid," is still initializing after ",batch.timeout," seconds"}.warning("userlist");
+				}
+				break;
+
+			case Batch::Failed:
+				if(!removed) {
+					initializing.erase(it);
+				}
+				break;
+
+			case Batch::Ready:
+				if(removed) {
+					// Removed (or the list was stopped) while initializing.
+					session->deinit();
+				} else {
+					initializing.erase(it);
+					push_back(session);
+					added.push_back(session);
+				}
+				break;
+			}
+
+		}
+
+		for(auto &session : added) {
+
+			try {
+
+				if(loaded) {
+					session->flags.alive = true;
+					session->emit(batch.event);
+				}
+
+				refresh_state(*session);
+
+			} catch(const std::exception &e) {
+
+				Logger::String{e.what()}.error("userlist");
+
+			}
+
+		}
+
+		publish();
+
+		batch.closed = true;
+		batch.changed.notify_all();
+
+	}
+
+	void User::List::initialized(std::shared_ptr<Session> session, const Event event, bool success) noexcept {
+
+		lock_guard<recursive_mutex> lock(guard);
+
+		auto it = initializing.find(session->sid);
+		if(it == initializing.end() || it->second != session) {
+			// Removed (or the list was stopped) while initializing.
+			session->deinit();
+			return;
+		}
+
+		initializing.erase(it);
+
+		if(!success) {
+			return;
+		}
+
+		push_back(session);
 
 		try {
-			session->sid = sid;
-			session->init();
-		} catch(...) {
-			delete session;
-			throw;
+
+			if(loaded) {
+				session->flags.alive = true;
+				session->emit(event);
+			}
+
+			refresh_state(*session);
+
+		} catch(const std::exception &e) {
+
+			Logger::String{e.what()}.error("userlist");
+
 		}
 
-		return *session;
+		publish();
+
 	}
 
-	User::List::List() {
+	User::List::List() : logind{make_shared<LoginD>()} {
 		efd = eventfd(0,0);
 		if(efd < 0) {
 			Logger::String{"Error getting eventfd: ",strerror(errno)}.error("users");
@@ -280,73 +716,80 @@
 		}
 #endif // HAVE_DBUS
 
-		// Activate logind monitor.
-		init();
-
-		monitor = new std::thread([this](){
-
-			pthread_setname_np(pthread_self(),"logind");
-
-			Logger::trace() << "users\tlogind monitor is activating" << endl;
-
-			{
-				char **ids = nullptr;
-				int idCount = sd_get_sessions(&ids);
-
-				lock_guard<recursive_mutex> lock(guard);
-				for(int id = 0; id < idCount; id++) {
-
-					try {
-
-						Session *session = new Session();
+		// Session lifecycle backend: 'monitor' (sd_login_monitor/inotify) or 'signals' (logind SessionNew/SessionRemoved).
+		{
+			string backend = Config::Value<string>("user-session","backend","monitor");
+			signal_driven = !strcasecmp(backend.c_str(),"signals");
+		}
 
-						session->sid = ids[id];
-						session->init();
+		if(signal_driven || Config::Value<bool>("user-session","subscribe-session-properties",true)) {
+			try {
+				logind->subscribe(signal_driven);
+			} catch(const std::exception &e) {
+				cerr << "users\tError '" << e.what() << "' subscribing to logind session signals" << endl;
+				if(signal_driven) {
+					cerr << "users\tFalling back to the logind monitor backend" << endl;
+					signal_driven = false;
+				}
+			}
+		}
 
-						char *state = nullptr;
-						if(sd_session_get_state(ids[id], &state) >= 0) {
-							session->set(User::StateFactory(state));
-							free(state);
-						}
+		if(!signal_driven && Config::Value<bool>("user-session","watch-session-records",true)) {
+			try {
+				watcher = make_shared<Watcher>();
+			} catch(const std::exception &e) {
+				cerr << "users\tError '" << e.what() << "' watching session records, using full refresh" << endl;
+			}
+		}
 
-					} catch(const std::exception &e) {
+		// Activate logind monitor.
+		init();
 
-						Logger::String{e.what()}.error("userlist");
+#if UDJAT_CHECK_VERSION(1,2,0)
+		if(Config::Value<bool>("user-session","use-main-loop",false)) {
 
-					}
+			// No monitor thread, the file descriptors are polled by the udjat main loop.
+			start();
+			watch();
+			cout << "users\tLogind monitor is now active on the main loop" << endl;
+			return;
 
-					free(ids[id]);
-				}
+		}
+#endif // UDJAT_CHECK_VERSION
 
-				free(ids);
+		monitor = new std::thread([this](){
 
-			}
+			pthread_setname_np(pthread_self(),"logind");
 
-			init();
+			Logger::trace() << "users\tlogind monitor is activating" << endl;
 
-			sd_login_monitor * monitor = NULL;
-			sd_login_monitor_new(NULL,&monitor);
+			start();
 
 			while(enabled) {
 
-				struct pollfd pfd[2];
+				// Apply logind signals received since the last check.
+				dispatch();
+
+				struct pollfd pfd[4];
 				memset(&pfd,0,sizeof(pfd));
 
-				pfd[0].fd = sd_login_monitor_get_fd(monitor);
-				pfd[0].events = sd_login_monitor_get_events(monitor) | SA_RESTART;
+				pfd[0].fd = (login_monitor ? sd_login_monitor_get_fd(login_monitor) : -1);
+				pfd[0].events = (login_monitor ? sd_login_monitor_get_events(login_monitor) : 0) | SA_RESTART;
 				pfd[0].revents = 0;
 				pfd[1].fd = efd;
 				pfd[1].events = POLLIN;
 				pfd[1].revents = 0;
+				pfd[2].fd = logind->fd();
+				pfd[2].events = logind->events();
+				pfd[2].revents = 0;
+				pfd[3].fd = ((watcher && !signal_driven) ? watcher->descriptor() : -1);
+				pfd[3].events = POLLIN;
+				pfd[3].revents = 0;
 
-				uint64_t timeout_usec = 10;
-				sd_login_monitor_get_timeout(monitor,&timeout_usec);
-
-				if(efd < 0 && timeout_usec > 1000) {
-					timeout_usec = 1000;
-				}
+				// logind->fd() reopens a lost connection, schedule the reload before waiting.
+				on_reconnect();
 
-				int rcPoll = poll(pfd, 2, timeout_usec);
+				int rcPoll = poll(pfd, 4, timeout());
 				debug("rcPoll=",rcPoll);
 
 				switch(rcPoll) {
@@ -363,15 +806,23 @@
 
 				default:	// Has event.
 					if(pfd[0].revents) {
-						sd_login_monitor_flush(monitor);
-						refresh();
+						on_login_monitor();
+					}
+					if(pfd[1].revents) {
+						on_wakeup();
+					}
+					if(pfd[3].revents) {
+						on_session_records();
 					}
 				}
+
+				on_timer();
+
 			}
 
 			clog << "users\tlogind monitor is deactivating" << endl;
 
-			deinit();
+			stop();
 
 		});
 
@@ -381,12 +832,10 @@
 
 	void User::List::wakeup() {
 		if(efd >= 0) {
-			static uint64_t evNum = 1;
-			debug("wake-up event ",evNum);
+			static const uint64_t evNum = 1;
 			if(write(efd, &evNum, sizeof(evNum)) != sizeof(evNum)) {
 				Logger::String{"Error '",strerror(errno),"' writing to event loop using fd ",efd}.error("users");
 			}
-			evNum++;
 		}
 	}
 
@@ -417,6 +866,13 @@
 			delete monitor;
 			monitor = nullptr;
 			cout << "users\tlogind monitor is now inactive" << endl;
+
+		} else if(!handlers.empty()) {
+
+			// Running on the main loop.
+			stop();
+			cout << "users\tlogind monitor is now inactive" << endl;
+
 		}
 
 		deinit(); // Just in case.
@@ -19,6 +19,8 @@
 
  #include <config.h>
  #include <udjat/tools/user/session.h>
+ #include <udjat/tools/user/list.h>
+ #include <udjat/tools/logger.h>
  #include <dirent.h>
  #include <systemd/sd-login.h>
  #include <cstdlib>
@@ -26,7 +28,10 @@
  #include <fcntl.h>
  #include <unistd.h>
  #include <cstring>
- #include <udjat/tools/file.h>
+ #include <cctype>
+ #include <cstdio>
+ #include <fstream>
+ #include <vector>
 
  using namespace std;
 
@@ -38,7 +43,10 @@
 		int descriptor = -1;
 
 	public:
-		Environ(DIR * dir, const char *name) : descriptor(openat(dirfd(dir),(string{name} + "/environ").c_str(),O_RDONLY)) {
+		Environ(DIR * dir, const char *name) : descriptor(openat(dirfd(dir),(string{name} + "/environ").c_str(),O_RDONLY|O_CLOEXEC)) {
+		}
+
+		Environ(pid_t pid) : descriptor(::open((string{"/proc/"} + std::to_string(pid) + "/environ").c_str(),O_RDONLY|O_CLOEXEC)) {
 		}
 
 		~Environ() {
@@ -63,8 +71,116 @@
 			return this->descriptor;
 		}
 
+		/// @brief Read the environment block into a reusable buffer.
+		/// @return Length of the environment block.
+		size_t read(std::string &buffer) {
+
+			if(buffer.size() < 4096) {
+				buffer.resize(4096);
+			}
+
+			size_t length = 0;
+			for(;;) {
+
+				if(length == buffer.size()) {
+					buffer.resize(buffer.size() * 2);
+				}
+
+				ssize_t bytes = ::read(descriptor,&buffer[length],buffer.size()-length);
+				if(bytes < 0 && errno == EINTR) {
+					continue;
+				}
+
+				if(bytes <= 0) {
+					break;
+				}
+
+				length += bytes;
+			}
+
+			// The buffer is reused, terminate the block so the last value can't run into bytes
+			// left over from a longer environment.
+			if(length == buffer.size()) {
+				buffer.resize(length+1);
+			}
+			buffer[length] = 0;
+
+			return length;
+
+		}
+
+		/// @brief Search environment block for a variable.
+		/// @return Pointer to the variable value, nullptr if not found.
+		static const char * search(const std::string &buffer, size_t length, const char *varname, size_t szName) {
+
+			const char *ptr = buffer.c_str();
+			const char *end = ptr + length;
+
+			while(ptr < end) {
+
+				size_t szEntry = strnlen(ptr,end-ptr);
+				if(szEntry > szName && ptr[szName] == '=' && strncmp(ptr,varname,szName) == 0) {
+					return ptr+szName+1;
+				}
+
+				ptr += (szEntry+1);
+			}
+
+			return nullptr;
+
+		}
+
 	};
 
+	/// @brief Get the processes of the session's scope cgroup.
+	/// @param leader The session leader.
+	/// @param pids Receives the pids on the cgroup, except the leader.
+	/// @return true if the cgroup was found.
+	static bool scope(pid_t leader, std::vector<pid_t> &pids) {
+
+		// Get cgroup from leader.
+		std::string cgroup;
+		{
+			std::ifstream file{string{"/proc/"} + std::to_string(leader) + "/cgroup"};
+			std::string entry;
+			while(std::getline(file,entry)) {
+
+				if(!strncmp(entry.c_str(),"0::",3)) {
+					// Unified hierarchy.
+					cgroup = string{"/sys/fs/cgroup"} + (entry.c_str()+3);
+					break;
+				}
+
+				const char *legacy = strstr(entry.c_str(),":name=systemd:");
+				if(legacy) {
+					cgroup = string{"/sys/fs/cgroup/systemd"} + (legacy+14);
+					break;
+				}
+
+			}
+		}
+
+		if(cgroup.empty() || cgroup.find(".scope") == string::npos) {
+			return false;
+		}
+
+		FILE *procs = fopen((cgroup + "/cgroup.procs").c_str(),"r");
+		if(!procs) {
+			return false;
+		}
+
+		int pid;
+		while(fscanf(procs,"%d",&pid) == 1) {
+			if(pid != leader) {
+				pids.push_back((pid_t) pid);
+			}
+		}
+
+		fclose(procs);
+
+		return true;
+
+	}
 
 	string User::Session::getenv(const char *varname) const {
 
@@ -75,10 +191,55 @@
 		// This would be far more easier with the fix of the issue
 		// https://gitlab.gnome.org/GNOME/gnome-shell/-/issues/741#
 
+		// Already resolved by User::List?
+		{
+			auto it = environment.find(varname);
+			if(it != environment.end()) {
+				return it->second;
+			}
+		}
+
 		string value;
+		string buffer;
 		size_t szName = strlen(varname);
 		uid_t uid = this->userid();
 
+		// Fast path, search only the processes of the session's scope, starting from the leader.
+		{
+			pid_t leader = 0;
+			auto record = this->record();
+			if(record) {
+				leader = record->leader;
+			} else if(sd_session_get_leader(sid.c_str(),&leader) < 0) {
+				leader = 0;
+			}
+
+			if(leader > 0) {
+
+				std::vector<pid_t> pids{leader};
+
+				scope(leader,pids);
+
+				for(pid_t pid : pids) {
+
+					Environ environ(pid);
+					if(!environ || environ.uid() != uid) {
+						continue;
+					}
+
+					size_t length = environ.read(buffer);
+					const char *ptr = Environ::search(buffer,length,varname,szName);
+					if(ptr) {
+						return ptr;
+					}
+
+				}
+
+			}
+		}
+
+		// Not found on session scope, scan all processes.
+
 		// https://stackoverflow.com/questions/6496847/access-another-users-d-bus-session
 		DIR * dir = opendir("/proc");
         if(!dir) {
@@ -113,14 +274,10 @@
 
 
 				// It's an user environment, scan it.
-				{
-					File::Text text(environ.fd());
-					for(const char *ptr = text.c_str(); *ptr; ptr += (strlen(ptr)+1)) {
-						if(strncmp(ptr,varname,szName) == 0 && ptr[szName] == '=') {
-							value.assign(ptr+szName+1);
-							break;
-						}
-					}
+				size_t length = environ.read(buffer);
+				const char *ptr = Environ::search(buffer,length,varname,szName);
+				if(ptr) {
+					value.assign(ptr);
 				}
 			}
 
@@ -137,4 +294,85 @@
 
 	}
 
+	void User::List::getenv(const std::vector<Session *> &sessions, const std::vector<std::string> &varnames) {
+
+		if(sessions.empty() || varnames.empty()) {
+			return;
+		}
+
+		std::unordered_map<std::string, Session *> targets;
+		for(Session *session : sessions) {
+			targets[session->sid] = session;
+		}
+
+		DIR * dir = opendir("/proc");
+		if(!dir) {
+			throw std::system_error(errno, std::system_category());
+		}
+
+		size_t processes = 0;
+		std::string buffer;
+
+		try {
+
+			struct dirent *ent;
+			while((ent=readdir(dir))!=NULL) {
+
+				if(!isdigit(ent->d_name[0])) {
+					continue;
+				}
+
+				// Get the process session.
+				Session *session;
+				{
+					char *sname = nullptr;
+					if(sd_pid_get_session(atoi(ent->d_name), &sname) < 0 || !sname) {
+						continue;
+					}
+
+					auto it = targets.find(sname);
+					free(sname);
+
+					if(it == targets.end()) {
+						continue;
+					}
+
+					session = it->second;
+				}
+
+				if(session->environment.size() >= varnames.size()) {
+					// Already got all the variables for this session.
+					continue;
+				}
+
+				Environ environ(dir,ent->d_name);
+				if(!environ || environ.uid() != (uid_t) session->userid()) {
+					continue;
+				}
+
+				processes++;
+
+				size_t length = environ.read(buffer);
+				for(const std::string &varname : varnames) {
+					const char *ptr = Environ::search(buffer,length,varname.c_str(),varname.size());
+					if(ptr) {
+						session->environment.emplace(varname,ptr);
+					}
+				}
+
+			}
+
+		} catch(...) {
+
+			closedir(dir);
+			throw;
+
+		}
+
+		closedir(dir);
+
+		Logger::String{"Environment of ",targets.size()," session(s) resolved from ",processes," process(es)"}.trace("userlist");
+
+	}
+
  }
@@ -0,0 +1,680 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2021 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ /**
+  * @brief Implements the persistent sd-bus connection with logind.
+  */
+
+ #include <config.h>
+ #include "private.h"
+ #include <systemd/sd-bus.h>
+ #include <udjat/tools/logger.h>
+ #include <cstring>
+ #include <ctime>
+ #include <poll.h>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	User::List::LoginD::~LoginD() {
+		lock_guard<mutex> lock(guard);
+		unsubscribe();
+		if(bus) {
+			sd_bus_flush_close_unref(bus);
+			bus = nullptr;
+		}
+	}
+
+	sd_bus * User::List::LoginD::connection() {
+
+		if(bus) {
+			return bus;
+		}
+
+		int rc = sd_bus_open_system(&bus);
+		if(rc < 0) {
+			bus = nullptr;
+			throw system_error(-rc,system_category(),string{"Unable to open system bus (rc="}+std::to_string(rc)+")");
+		}
+
+		if(watching) {
+			try {
+				subscribe(bus);
+			} catch(const std::exception &e) {
+				Logger::String{e.what()}.error("logind");
+			}
+		}
+
+		return bus;
+
+	}
+
+	void User::List::LoginD::check(int rc) noexcept {
+
+		// Drop a broken connection, the next call will reconnect.
+		if(bus && (rc == -ECONNRESET || rc == -ENOTCONN)) {
+			unsubscribe();
+			sd_bus_unref(bus);
+			bus = nullptr;
+			lost = true;
+		}
+
+	}
+
+	bool User::List::LoginD::pending() noexcept {
+
+		if(!(watching && bus)) {
+			return false;
+		}
+
+		// Messages read during a synchronous call stay queued without making the descriptor
+		// readable again, sd-bus reports them as an expired timeout.
+		uint64_t usec = (uint64_t) -1;
+		if(sd_bus_get_timeout(bus,&usec) >= 0 && usec == 0) {
+			return true;
+		}
+
+		int events = sd_bus_get_events(bus);
+		return events > 0 && (events & POLLOUT);
+
+	}
+
+	bool User::List::LoginD::reconnected() noexcept {
+
+		lock_guard<mutex> lock(guard);
+
+		if(lost && bus) {
+			lost = false;
+			return true;
+		}
+
+		return false;
+
+	}
+
+	int User::List::LoginD::on_properties_changed(sd_bus_message *message, void *userdata, sd_bus_error *) {
+
+		// https://dbus.freedesktop.org/doc/dbus-specification.html#standard-interfaces-properties
+		LoginD *logind = (LoginD *) userdata;
+
+		const char *interface = nullptr;
+		if(sd_bus_message_read(message,"s",&interface) < 0 || !interface || strcmp(interface,"org.freedesktop.login1.Session")) {
+			return 0;
+		}
+
+		if(sd_bus_message_enter_container(message,SD_BUS_TYPE_ARRAY,"{sv}") < 0) {
+			return 0;
+		}
+
+		Change change{sd_bus_message_get_path(message)};
+
+		while(sd_bus_message_enter_container(message,SD_BUS_TYPE_DICT_ENTRY,"sv") > 0) {
+
+			const char *name = nullptr;
+			if(sd_bus_message_read(message,"s",&name) < 0 || !name) {
+				break;
+			}
+
+			int value = 0;
+			if(!strcmp(name,"LockedHint")) {
+				if(sd_bus_message_read(message,"v","b",&value) >= 0) {
+					change.locked = (value != 0);
+				}
+			} else if(!strcmp(name,"Active")) {
+				if(sd_bus_message_read(message,"v","b",&value) >= 0) {
+					change.active = (value != 0);
+				}
+			} else if(!strcmp(name,"IdleHint")) {
+				if(sd_bus_message_read(message,"v","b",&value) >= 0) {
+					change.idle = (value != 0);
+				}
+			} else if(!strcmp(name,"State")) {
+				const char *state = nullptr;
+				if(sd_bus_message_read(message,"v","s",&state) >= 0 && state) {
+					change.state = state;
+				}
+			} else {
+				sd_bus_message_skip(message,"v");
+			}
+
+			sd_bus_message_exit_container(message);
+		}
+
+		sd_bus_message_exit_container(message);
+
+		logind->changes.push_back(change);
+
+		return 0;
+	}
+
+	int User::List::LoginD::on_manager_signal(sd_bus_message *message, void *userdata, sd_bus_error *) {
+
+		// https://www.freedesktop.org/software/systemd/man/latest/org.freedesktop.login1.html#Signals
+		LoginD *logind = (LoginD *) userdata;
+
+		const char *member = sd_bus_message_get_member(message);
+		if(!member) {
+			return 0;
+		}
+
+		int lifecycle = 0;
+		if(!strcmp(member,"SessionNew")) {
+			lifecycle = 1;
+		} else if(!strcmp(member,"SessionRemoved")) {
+			lifecycle = -1;
+		} else {
+			return 0;
+		}
+
+		const char *sid = nullptr;
+		const char *path = nullptr;
+		if(sd_bus_message_read(message,"so",&sid,&path) < 0 || !sid || !path) {
+			return 0;
+		}
+
+		Change change{path};
+		change.sid = sid;
+		change.lifecycle = lifecycle;
+
+		logind->changes.push_back(change);
+
+		return 0;
+	}
+
+	void User::List::LoginD::subscribe(sd_bus *bus) {
+
+		// Single wildcard match for all the session objects.
+		static const char *rules[] = {
+			"type='signal',"
+			"sender='org.freedesktop.login1',"
+			"interface='org.freedesktop.DBus.Properties',"
+			"member='PropertiesChanged',"
+			"path_namespace='/org/freedesktop/login1/session',"
+			"arg0='org.freedesktop.login1.Session'",
+
+			"type='signal',"
+			"sender='org.freedesktop.login1',"
+			"interface='org.freedesktop.login1.Manager',"
+			"path='/org/freedesktop/login1'"
+		};
+
+		static const sd_bus_message_handler_t handlers[] = {
+			on_properties_changed,
+			on_manager_signal
+		};
+
+		unsubscribe();
+
+		// The manager match is only required when the session lifecycle is signal driven.
+		size_t count = (sizeof(rules)/sizeof(rules[0]));
+		if(!lifecycle) {
+			count--;
+		}
+
+		for(size_t ix = 0; ix < count; ix++) {
+			int rc = sd_bus_add_match(bus,&slots[ix],rules[ix],handlers[ix],this);
+			if(rc < 0) {
+				unsubscribe();
+				throw system_error(-rc,system_category(),"Unable to subscribe to logind session signals");
+			}
+		}
+
+	}
+
+	void User::List::LoginD::unsubscribe() noexcept {
+		for(sd_bus_slot * &slot : slots) {
+			if(slot) {
+				sd_bus_slot_unref(slot);
+				slot = nullptr;
+			}
+		}
+	}
+
+	void User::List::LoginD::subscribe(bool sessions) {
+
+		lock_guard<mutex> lock(guard);
+
+		if(watching && (lifecycle || !sessions)) {
+			return;
+		}
+
+		watching = true;
+		lifecycle = (lifecycle || sessions);
+
+		try {
+
+			if(bus) {
+				subscribe(bus);
+			} else {
+				connection();
+			}
+
+		} catch(...) {
+			watching = false;
+			throw;
+		}
+
+		if(!slots[0] || (lifecycle && !slots[1])) {
+			watching = false;
+			lifecycle = false;
+			throw runtime_error("Unable to subscribe to logind session signals");
+		}
+
+	}
+
+	int User::List::LoginD::fd() noexcept {
+
+		lock_guard<mutex> lock(guard);
+
+		if(!watching) {
+			return -1;
+		}
+
+		try {
+			return sd_bus_get_fd(connection());
+		} catch(const std::exception &e) {
+			Logger::String{e.what()}.error("logind");
+		}
+
+		return -1;
+
+	}
+
+	short User::List::LoginD::events() noexcept {
+
+		lock_guard<mutex> lock(guard);
+
+		if(!bus) {
+			return 0;
+		}
+
+		int rc = sd_bus_get_events(bus);
+		return rc < 0 ? 0 : (short) rc;
+
+	}
+
+	std::vector<User::List::LoginD::Change> User::List::LoginD::process() noexcept {
+
+		lock_guard<mutex> lock(guard);
+
+		if(bus) {
+
+			int rc;
+			while((rc = sd_bus_process(bus,NULL)) > 0);
+
+			if(rc < 0) {
+				Logger::String{"Error processing logind messages: ",strerror(-rc)}.error("logind");
+				check(rc);
+			}
+
+		}
+
+		std::vector<Change> received;
+		received.swap(changes);
+		return received;
+
+	}
+
+	void User::List::dispatch() noexcept {
+
+		auto changes = logind->process();
+		if(changes.empty()) {
+			return;
+		}
+
+		lock_guard<recursive_mutex> lock(guard);
+
+		// Session lifecycle signals, only received when the backend is signal driven.
+		{
+			std::set<std::string> created;
+			std::set<std::string> removed;
+
+			for(const LoginD::Change &change : changes) {
+				if(change.lifecycle > 0) {
+					Logger::String{"SessionNew @",change.sid}.trace("logind");
+					removed.erase(change.sid);
+					created.insert(change.sid);
+					announced[change.sid] = change.path;
+				} else if(change.lifecycle < 0) {
+					Logger::String{"SessionRemoved @",change.sid}.trace("logind");
+					created.erase(change.sid);
+					removed.insert(change.sid);
+					announced.erase(change.sid);
+				}
+			}
+
+			if(!created.empty() || !removed.empty()) {
+				refresh(created,removed);
+			}
+		}
+
+		for(const LoginD::Change &change : changes) {
+
+			if(change.lifecycle) {
+				continue;
+			}
+
+			char *sid = nullptr;
+			if(sd_bus_path_decode(change.path.c_str(),"/org/freedesktop/login1/session",&sid) <= 0 || !sid) {
+				continue;
+			}
+
+			auto it = index.find(sid);
+			free(sid);
+
+			if(it == index.end()) {
+				// Not loaded yet, refresh() will get the current state.
+				continue;
+			}
+
+			Session &session = **it->second;
+
+			if(change.active >= 0) {
+				session.flags.hints.active = (int8_t) (change.active ? 1 : 0);
+			}
+
+			if(change.idle >= 0) {
+				session.flags.idle = (change.idle != 0);
+			}
+
+			if(change.locked >= 0) {
+
+				bool locked = (change.locked != 0);
+				session.flags.hints.locked = (int8_t) (locked ? 1 : 0);
+
+				if(session.flags.locked.exchange(locked) != locked) {
+					session.info() << "Session is now " << (locked ? "locked" : "unlocked") << endl;
+					session.emit(locked ? User::lock : User::unlock);
+				}
+
+			}
+
+			if(!change.state.empty()) {
+				session.set(User::StateFactory(change.state.c_str()));
+			}
+
+		}
+
+	}
+
+	std::string User::List::LoginD::path(const char *sid) {
+
+		lock_guard<mutex> lock(guard);
+
+		sd_bus_error error = SD_BUS_ERROR_NULL;
+		sd_bus_message *reply = NULL;
+
+		int rc = sd_bus_call_method(
+						connection(),
+						"org.freedesktop.login1",
+						"/org/freedesktop/login1",
+						"org.freedesktop.login1.Manager",
+						"GetSession",
+						&error,
+						&reply,
+						"s", sid
+					);
+
+		if(rc < 0) {
+			check(rc);
+			string message{error.message ? error.message : strerror(-rc)};
+			sd_bus_error_free(&error);
+			throw system_error(-rc,system_category(),message);
+		} else if(!reply) {
+			throw runtime_error("No reply from org.freedesktop.login1.Manager.GetSession");
+		}
+
+		const char *path = NULL;
+		rc = sd_bus_message_read_basic(reply,SD_BUS_TYPE_OBJECT_PATH,&path);
+		if(rc < 0) {
+			sd_bus_message_unref(reply);
+			throw system_error(-rc,system_category(),"org.freedesktop.login1.Manager.GetSession");
+		}
+
+		if(!(path && *path)) {
+			sd_bus_message_unref(reply);
+			throw runtime_error("Empty response from org.freedesktop.login1.Manager.GetSession");
+		}
+
+		string response{path};
+		sd_bus_message_unref(reply);
+
+		if(pending()) {
+			// Signals were queued during the call, let the monitor dispatch them.
+			List::getInstance().wakeup();
+		}
+
+		return response;
+
+	}
+
+	bool User::List::LoginD::locked(const char *path) {
+
+		lock_guard<mutex> lock(guard);
+
+		int hint = 0;
+		sd_bus_error error = SD_BUS_ERROR_NULL;
+		sd_bus_message *reply = NULL;
+
+		int rc = sd_bus_call_method(
+						connection(),
+						"org.freedesktop.login1",
+						path,
+						"org.freedesktop.DBus.Properties",
+						"Get",
+						&error,
+						&reply,
+						"ss", "org.freedesktop.login1.Session", "LockedHint"
+					);
+
+		if(rc < 0) {
+			check(rc);
+			string message{Logger::Message(error.message ? error.message : strerror(-rc)," (rc=",-rc,")")};
+			sd_bus_error_free(&error);
+			throw system_error(-rc,system_category(),message);
+		} else if(!reply) {
+			throw runtime_error("Empty response from org.freedesktop.login1.LockedHint");
+		}
+
+		rc = sd_bus_message_read(reply,"v","b",&hint);
+		sd_bus_message_unref(reply);
+
+		if(pending()) {
+			List::getInstance().wakeup();
+		}
+
+		if(rc < 0) {
+			throw system_error(-rc,system_category(),"Can't read response from org.freedesktop.login1.LockedHint");
+		}
+
+		return (hint != 0);
+
+	}
+
+	void User::List::LoginD::locked(std::vector<Query> &queries) {
+
+		if(queries.empty()) {
+			return;
+		}
+
+		lock_guard<mutex> lock(guard);
+
+		sd_bus *bus = connection();
+
+		struct Pending {
+			Query *query;
+			sd_bus_slot *slot = nullptr;
+			size_t *count;
+		};
+
+		size_t count = 0;
+		vector<Pending> pending;
+		pending.reserve(queries.size());
+
+		// Send all requests before waiting for the first reply.
+		for(Query &query : queries) {
+
+			pending.push_back(Pending{&query,nullptr,&count});
+			Pending &request = pending.back();
+
+			int rc = sd_bus_call_method_async(
+							bus,
+							&request.slot,
+							"org.freedesktop.login1",
+							query.path.c_str(),
+							"org.freedesktop.DBus.Properties",
+							"Get",
+							[](sd_bus_message *reply, void *userdata, sd_bus_error *) -> int {
+
+								Pending *request = (Pending *) userdata;
+								(*request->count)--;
+
+								if(sd_bus_message_is_method_error(reply,NULL)) {
+									const sd_bus_error *error = sd_bus_message_get_error(reply);
+									Logger::String{
+										"Error getting LockedHint for ",request->query->path,": ",
+										(error && error->message) ? error->message : "Unexpected error"
+									}.error("logind");
+									return 0;
+								}
+
+								int hint = 0;
+								if(sd_bus_message_read(reply,"v","b",&hint) >= 0) {
+									request->query->hint = (hint != 0);
+								}
+
+								return 0;
+							},
+							&request,
+							"ss", "org.freedesktop.login1.Session", "LockedHint"
+						);
+
+			if(rc < 0) {
+				Logger::String{"Error querying LockedHint for ",query.path,": ",strerror(-rc)}.error("logind");
+				pending.pop_back();
+				continue;
+			}
+
+			count++;
+
+		}
+
+		// Process replies until all of them arrive or timeout.
+		time_t limit = time(0) + 5;
+		while(count && time(0) <= limit) {
+
+			int rc = sd_bus_process(bus,NULL);
+
+			if(rc < 0) {
+				Logger::String{"Error processing logind replies: ",strerror(-rc)}.error("logind");
+				check(rc);
+				break;
+			}
+
+			if(rc > 0) {
+				continue;
+			}
+
+			rc = sd_bus_wait(bus,1000000);
+			if(rc < 0 && rc != -EINTR) {
+				Logger::String{"Error waiting for logind replies: ",strerror(-rc)}.error("logind");
+				break;
+			}
+
+		}
+
+		if(count) {
+			Logger::String{"Timeout waiting for ",count," LockedHint replies"}.warning("logind");
+		}
+
+		// Release slots, this cancels the callbacks still pending.
+		for(Pending &request : pending) {
+			sd_bus_slot_unref(request.slot);
+		}
+
+		if(this->bus) {
+			sd_bus_flush(this->bus);
+		}
+
+		if(this->pending()) {
+			List::getInstance().wakeup();
+		}
+
+	}
+
+	std::unordered_map<const User::Session *, bool> User::List::locked(const Snapshot &sessions) {
+
+		// Don't take the guard, the logind queries can wait for the bus timeout.
+		std::unordered_map<const Session *, bool> states;
+		std::vector<LoginD::Query> queries;
+		std::vector<const Session *> owners;
+
+		queries.reserve(sessions.size());
+		owners.reserve(sessions.size());
+
+		for(auto &entry : sessions) {
+
+			const Session *session = entry.get();
+
+			int8_t hint = session->flags.hints.locked;
+			if(hint >= 0) {
+				states[session] = (hint != 0);
+				continue;
+			}
+
+			try {
+				queries.emplace_back(session->path());
+				owners.push_back(session);
+			} catch(const std::exception &e) {
+				session->error() << e.what() << endl;
+			}
+		}
+
+		if(queries.empty()) {
+			return states;
+		}
+
+		logind->locked(queries);
+
+		bool cache = logind->subscribed();
+
+		for(size_t ix = 0; ix < queries.size(); ix++) {
+			if(queries[ix].hint >= 0) {
+
+				int8_t hint = (int8_t) (queries[ix].hint ? 1 : 0);
+
+				if(cache) {
+					// Don't overwrite a hint received from a signal while querying.
+					int8_t expected = -1;
+					Session *session = const_cast<Session *>(owners[ix]);
+					if(!session->flags.hints.locked.compare_exchange_strong(expected,hint)) {
+						hint = expected;
+					}
+				}
+
+				states[owners[ix]] = (hint != 0);
+
+			}
+		}
+
+		return states;
+	}
+
+ }
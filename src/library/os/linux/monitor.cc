@@ -0,0 +1,326 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2024 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ /**
+  * @brief Session monitor events, shared by the monitor thread and the main loop.
+  */
+
+ #include <config.h>
+ #include "private.h"
+ #include <udjat/tools/logger.h>
+ #include <systemd/sd-login.h>
+ #include <sys/timerfd.h>
+ #include <unistd.h>
+ #include <climits>
+ #include <cstring>
+ #include <ctime>
+ #include <algorithm>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	/// @brief Get CLOCK_MONOTONIC time in milliseconds.
+	static uint64_t monotonic_ms() noexcept {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		return ((uint64_t) ts.tv_sec) * 1000ULL + (ts.tv_nsec / 1000000);
+	}
+
+	int User::List::timeout() noexcept {
+
+		int ms = -1;
+
+		if(login_monitor) {
+
+			// sd_login_monitor_get_timeout() returns an absolute CLOCK_MONOTONIC time in
+			// microseconds (or UINT64_MAX for none), poll() requires relative milliseconds.
+			uint64_t usec = (uint64_t) -1;
+			if(sd_login_monitor_get_timeout(login_monitor,&usec) >= 0 && usec != (uint64_t) -1) {
+
+				struct timespec ts;
+				clock_gettime(CLOCK_MONOTONIC,&ts);
+				uint64_t now = ((uint64_t) ts.tv_sec) * 1000000ULL + (ts.tv_nsec / 1000);
+
+				ms = (usec > now ? (int) std::min<uint64_t>((usec - now + 999) / 1000, INT_MAX) : 0);
+
+			}
+
+		}
+
+		if((watcher || signal_driven) && check.interval) {
+			time_t now = time(0);
+			int wait = (check.next > now ? (int) std::min<time_t>((check.next - now) * 1000, INT_MAX) : 0);
+			ms = (ms < 0 ? wait : std::min(ms,wait));
+		}
+
+		if(pending.deadline) {
+			uint64_t now = monotonic_ms();
+			int wait = (pending.deadline > now ? (int) std::min<uint64_t>(pending.deadline - now, INT_MAX) : 0);
+			ms = (ms < 0 ? wait : std::min(ms,wait));
+		}
+
+		if(efd < 0 && (ms < 0 || ms > 1000)) {
+			// No wake-up descriptor, check for deactivation every second.
+			ms = 1000;
+		}
+
+		return ms;
+
+	}
+
+	void User::List::on_login_monitor() noexcept {
+
+		if(login_monitor) {
+			sd_login_monitor_flush(login_monitor);
+		}
+
+		refreshes.requests++;
+		pending.full = true;
+
+		if(!pending.deadline) {
+			pending.deadline = monotonic_ms() + pending.window;
+		}
+
+		flush();
+
+	}
+
+	void User::List::on_session_records() noexcept {
+
+		Watcher::Changes changes;
+
+		try {
+			watcher->read(changes);
+		} catch(const std::exception &e) {
+			Logger::String{e.what()}.error("users");
+			changes.overflow = true;
+		}
+
+		if(changes.empty()) {
+			return;
+		}
+
+		refreshes.requests++;
+
+		if(changes.overflow) {
+			// Events were lost, rescan everything.
+			pending.full = true;
+		}
+
+		changes.modified.insert(changes.created.begin(),changes.created.end());
+
+		for(const string &sid : changes.deleted) {
+			pending.changed.erase(sid);
+			pending.deleted.insert(sid);
+		}
+
+		for(const string &sid : changes.modified) {
+			pending.deleted.erase(sid);
+			pending.changed.insert(sid);
+		}
+
+		if(!pending.deadline) {
+			pending.deadline = monotonic_ms() + pending.window;
+		}
+
+		flush();
+
+	}
+
+	void User::List::flush() noexcept {
+
+		if(!pending.deadline || monotonic_ms() < pending.deadline) {
+			return;
+		}
+
+		if(pending.full) {
+			refresh();
+		} else if(!(pending.changed.empty() && pending.deleted.empty())) {
+			refresh(pending.changed,pending.deleted);
+		}
+
+		pending.deadline = 0;
+		pending.full = false;
+		pending.changed.clear();
+		pending.deleted.clear();
+
+	}
+
+	void User::List::on_reconnect() noexcept {
+
+		// Signals were lost while disconnected, reload everything.
+		if(logind->reconnected()) {
+			Logger::String{"Reconnected to logind, reloading sessions"}.trace("users");
+			refreshes.requests++;
+			pending.full = true;
+			if(!pending.deadline) {
+				pending.deadline = monotonic_ms() + pending.window;
+			}
+		}
+
+	}
+
+	void User::List::on_wakeup() noexcept {
+		uint64_t evNum;
+		if(read(efd,&evNum,sizeof(evNum)) != sizeof(evNum)) {
+			debug("Error reading from eventfd");
+		}
+	}
+
+	void User::List::on_timer() noexcept {
+
+		flush();
+
+		if((watcher || signal_driven) && check.interval && time(0) >= check.next) {
+			Logger::String{"Running session consistency check"}.trace("users");
+			refresh();
+			check.next = time(0) + check.interval;
+		}
+
+	}
+
+	void User::List::watch() {
+
+#if UDJAT_CHECK_VERSION(1,2,0)
+
+		auto add = [this](int fd, const std::function<void(Handler &handler)> &callback) {
+			if(fd >= 0) {
+				auto handler = make_shared<Handler>(fd,callback);
+				handler->enable();
+				handlers.push_back(handler);
+			}
+		};
+
+		add(efd,[this](Handler &){
+			on_wakeup();
+			dispatch();
+			rearm();
+		});
+
+		add(logind->fd(),[this](Handler &handler){
+
+			dispatch();
+
+			// The connection is reopened when lost, follow it.
+			int fd = logind->fd();
+			if(fd != handler.descriptor) {
+				handler.disable();
+				handler.descriptor = fd;
+				if(fd >= 0) {
+					handler.set(fd);
+					handler.enable();
+				}
+			}
+
+			on_reconnect();
+			rearm();
+
+		});
+
+		if(login_monitor) {
+			add(sd_login_monitor_get_fd(login_monitor),[this](Handler &){
+				on_login_monitor();
+				rearm();
+			});
+		}
+
+		if(watcher && !signal_driven) {
+			add(watcher->descriptor(),[this](Handler &){
+				on_session_records();
+				rearm();
+			});
+		}
+
+		tfd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC);
+		if(tfd < 0) {
+			Logger::String{"Error creating timer fd: ",strerror(errno)}.error("users");
+		} else {
+			add(tfd,[this](Handler &){
+				uint64_t expirations;
+				if(read(tfd,&expirations,sizeof(expirations)) != sizeof(expirations)) {
+					debug("Error reading from timerfd");
+				}
+				on_timer();
+				rearm();
+			});
+			rearm();
+		}
+
+#endif // UDJAT_CHECK_VERSION
+
+	}
+
+	void User::List::rearm() noexcept {
+
+		if(tfd < 0) {
+			return;
+		}
+
+		struct itimerspec spec;
+		memset(&spec,0,sizeof(spec));
+
+		int ms = timeout();
+		if(ms == 0) {
+			// Already expired, a zero value would disarm the timer.
+			spec.it_value.tv_nsec = 1;
+		} else if(ms > 0) {
+			spec.it_value.tv_sec = ms / 1000;
+			spec.it_value.tv_nsec = (ms % 1000) * 1000000L;
+		}
+
+		if(timerfd_settime(tfd,0,&spec,NULL) < 0) {
+			Logger::String{"Error setting timer fd: ",strerror(errno)}.error("users");
+		}
+
+	}
+
+	void User::List::stop() noexcept {
+
+#if UDJAT_CHECK_VERSION(1,2,0)
+		for(auto &handler : handlers) {
+			handler->disable();
+		}
+		handlers.clear();
+#endif // UDJAT_CHECK_VERSION
+
+		if(tfd >= 0) {
+			::close(tfd);
+			tfd = -1;
+		}
+
+		if(login_monitor) {
+			sd_login_monitor_unref(login_monitor);
+			login_monitor = nullptr;
+		}
+
+		watcher.reset();
+
+		{
+			// Sessions still initializing are dropped by initialized().
+			lock_guard<recursive_mutex> lock(guard);
+			initializing.clear();
+			loaded = false;
+		}
+
+		deinit();
+
+	}
+
+ }
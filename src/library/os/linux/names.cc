@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2024 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ /**
+  * @brief Implements the uid to user name cache.
+  */
+
+ #include <config.h>
+ #include "private.h"
+ #include <udjat/tools/configuration.h>
+ #include <udjat/tools/quark.h>
+ #include <udjat/tools/logger.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+ #include <pwd.h>
+ #include <cerrno>
+ #include <system_error>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	/// @brief Files changed when the user database changes.
+	static const char *databases[] = {
+		"/etc/passwd",
+		"/var/lib/sss/mc/passwd",		// sssd memory cache.
+		"/var/lib/sss/db",				// sssd cache.
+		"/var/db/nscd/passwd",			// nscd persistent database.
+		"/var/cache/nscd/passwd"
+	};
+
+	User::Session::Names & User::Session::Names::getInstance() {
+		static Names instance;
+		return instance;
+	}
+
+	void User::Session::Names::validate(time_t now) noexcept {
+
+		if(now == fingerprint.checked) {
+			return;
+		}
+		fingerprint.checked = now;
+
+		uint64_t value = 0;
+		for(const char *filename : databases) {
+			struct stat st;
+			if(stat(filename,&st) == 0) {
+				value = (value * 31) + ((uint64_t) st.st_ino) + ((uint64_t) st.st_mtim.tv_sec * 1000000000ULL) + st.st_mtim.tv_nsec;
+			} else {
+				value *= 31;
+			}
+		}
+
+		if(value != fingerprint.value) {
+			if(fingerprint.value && !entries.empty()) {
+				Logger::String{"User database has changed, dropping ",entries.size()," cached name(s)"}.trace("users");
+			}
+			entries.clear();
+			fingerprint.value = value;
+		}
+
+	}
+
+	const char * User::Session::Names::get(uid_t uid) {
+
+		time_t now = time(0);
+
+		{
+			lock_guard<mutex> lock(guard);
+
+			validate(now);
+
+			auto it = entries.find(uid);
+			if(it != entries.end() && it->second.expires > now) {
+				hits++;
+				return it->second.name;
+			}
+		}
+
+		misses++;
+
+		// Not cached, ask NSS without holding the guard (it can be slow).
+		long bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
+		if(bufsize < 0) {
+			bufsize = 16384;
+		}
+
+		const char *name = nullptr;
+		std::vector<char> buffer;
+
+		while(true) {
+
+			buffer.resize(bufsize);
+
+			struct passwd pwd;
+			struct passwd *result = nullptr;
+
+			int rc = getpwuid_r(uid, &pwd, buffer.data(), buffer.size(), &result);
+
+			if(rc == ERANGE && bufsize < 1048576) {
+				bufsize *= 2;
+				continue;
+			}
+
+			if(rc) {
+				// Lookup failure, not a missing user; don't cache it.
+				throw system_error(rc,system_category(),string{"Cant get name of uid "} + std::to_string(uid));
+			}
+
+			if(result && result->pw_name) {
+				name = Quark{result->pw_name}.c_str();
+			}
+
+			break;
+
+		}
+
+		Entry entry;
+		entry.name = name;
+		entry.expires = now + (time_t) (
+							name
+								? Config::Value<unsigned int>("user-session","username-ttl",600)
+								: Config::Value<unsigned int>("user-session","username-negative-ttl",30)
+						);
+
+		lock_guard<mutex> lock(guard);
+		entries[uid] = entry;
+
+		return name;
+
+	}
+
+	Value & User::Session::Names::getProperties(Value &value) {
+
+		{
+			lock_guard<mutex> lock(guard);
+			value["cached"] = (unsigned int) entries.size();
+		}
+
+		value["hits"] = (unsigned int) hits;
+		value["misses"] = (unsigned int) misses;
+
+		return value;
+	}
+
+ }
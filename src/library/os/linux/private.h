@@ -23,29 +23,340 @@
  #include <udjat/defs.h>
  #include <udjat/tools/user/session.h>
  #include <udjat/tools/user/list.h>
+ #include <systemd/sd-bus.h>
+ #include <mutex>
+ #include <string>
+ #include <vector>
+ #include <set>
+ #include <list>
+ #include <thread>
+ #include <unordered_map>
+ #include <atomic>
+ #include <ctime>
+
+ #include <functional>
+ #include <udjat/version.h>
 
  #ifdef HAVE_DBUS
 	#include <udjat/tools/dbus/connection.h>
  #endif // HAVE_DBUS
 
+ #if UDJAT_CHECK_VERSION(1,2,0)
+	#include <udjat/tools/handler.h>
+ #endif // UDJAT_CHECK_VERSION
+
  namespace Udjat {
 
  #ifdef HAVE_DBUS
-	class User::Session::Bus : public Udjat::DBus::NamedBus {
+	class User::List::Bus : public Udjat::DBus::SystemBus {
 	public:
-		Bus(const char *busname, const char *name) : Udjat::DBus::NamedBus{busname,name} {
+		Bus() : Udjat::DBus::SystemBus{} {
 		}
 
 	};
 
-	class User::List::Bus : public Udjat::DBus::SystemBus {
+ #endif // HAVE_DBUS
+
+	/// @brief Connection with the user's session bus.
+	/// @details The connections are not dispatched individually, a single thread polls all of them.
+	class User::Session::Bus {
 	public:
-		Bus() : Udjat::DBus::SystemBus{} {
+		class Dispatcher;
+
+		/// @brief Method reply handler (message is nullptr on error).
+		using Reply = std::function<void(sd_bus_message *message, const sd_bus_error *error)>;
+
+		/// @brief Signal handler.
+		using Signal = std::function<void(sd_bus_message *message)>;
+
+	private:
+		friend class Dispatcher;
+
+		std::mutex guard;
+		sd_bus *bus = nullptr;
+		const std::string name;
+
+		/// @brief Slots of the pending calls and signal matches.
+		std::vector<sd_bus_slot *> slots;
+
+		/// @brief Handlers (used as sd-bus userdata, must have stable addresses).
+		std::list<Reply> replies;
+		std::list<Signal> signals;
+
+		/// @brief Dispatch statistics.
+		struct {
+			unsigned long count = 0;		///< @brief Number of dispatches.
+			uint64_t total = 0;				///< @brief Total dispatch time (microseconds).
+			uint64_t max = 0;				///< @brief Maximum dispatch time (microseconds).
+		} dispatches;
+
+		static int on_reply(sd_bus_message *message, void *userdata, sd_bus_error *);
+		static int on_signal(sd_bus_message *message, void *userdata, sd_bus_error *);
+
+		/// @brief Process pending messages (called by the dispatcher).
+		void process() noexcept;
+
+	public:
+		/// @brief Connect to bus, call it with the user's effective id.
+		/// @details The connection is not dispatched until Dispatcher::insert(), which must be
+		/// called with the daemon credentials (Linux threads inherit the creator's ones).
+		/// @param name The session name (for logging).
+		/// @param address The bus address (DBUS_SESSION_BUS_ADDRESS).
+		Bus(const char *name, const char *address);
+		~Bus();
+
+		/// @brief Asynchronous method call without arguments, the reply handler runs on the dispatcher thread.
+		void call(const char *destination, const char *path, const char *interface, const char *member, const Reply &reply);
+
+		/// @brief Subscribe to signal, the handler runs on the dispatcher thread.
+		void subscribe(const char *interface, const char *member, const Signal &signal);
+
+	};
+
+	/// @brief Polls all the user bus connections from a single epoll loop.
+	class User::Session::Bus::Dispatcher {
+	private:
+		std::mutex guard;
+		int epfd = -1;						///< @brief The epoll descriptor.
+		int efd = -1;						///< @brief Wake-up event descriptor.
+		std::thread *thread = nullptr;
+		bool enabled = true;				///< @brief Cleared to stop the thread (requires the guard).
+
+		/// @brief Connections by file descriptor.
+		std::unordered_map<int, Bus *> buses;
+
+		/// @brief Statistics of the removed connections.
+		struct {
+			unsigned long count = 0;
+			uint64_t total = 0;
+			uint64_t max = 0;
+		} history;
+
+		Dispatcher();
+
+		/// @brief Watch connection (requires an active guard).
+		void watch(Bus *bus, int op) noexcept;
+
+		/// @brief Get the time to wait for the next sd-bus timeout (requires an active guard).
+		int timeout() noexcept;
+
+		void run();
+
+	public:
+		static Dispatcher & getInstance();
+		~Dispatcher();
+
+		/// @brief Start dispatching connection (never from inside Session::call()).
+		void insert(Bus *bus);
+
+		/// @brief Stop dispatching connection, waits for a running dispatch.
+		void remove(Bus *bus) noexcept;
+
+		/// @brief Connection has new data to send, update its events.
+		void update(Bus *bus) noexcept;
+
+		/// @brief Get connection count and dispatch latency.
+		Value & getProperties(Value &value);
+
+	};
+
+	/// @brief Process-wide uid to user name cache.
+	/// @details NSS lookups can be slow (LDAP/SSSD), the entries expire by TTL and are
+	/// invalidated when /etc/passwd or the nscd/sssd caches changes.
+	class User::Session::Names {
+	private:
+		std::mutex guard;
+
+		struct Entry {
+			const char *name = nullptr;		///< @brief Interned user name (nullptr if not found).
+			time_t expires = 0;
+		};
+
+		std::unordered_map<uid_t, Entry> entries;
+
+		/// @brief Fingerprint of the user databases.
+		struct {
+			time_t checked = 0;				///< @brief Last check (databases are stat'ed once per second).
+			uint64_t value = 0;
+		} fingerprint;
+
+		std::atomic<unsigned int> hits{0};
+		std::atomic<unsigned int> misses{0};
+
+		Names() = default;
+
+		/// @brief Drop entries if the user databases has changed (requires an active guard).
+		void validate(time_t now) noexcept;
+
+	public:
+		static Names & getInstance();
+
+		/// @brief Get user name.
+		/// @return Interned user name or nullptr if the uid is unknown.
+		const char * get(uid_t uid);
+
+		/// @brief Get cache hits and misses.
+		Value & getProperties(Value &value);
+
+	};
+
+	/// @brief Persistent sd-bus connection with logind, shared by all sessions.
+	class User::List::LoginD {
+	public:
+
+		/// @brief Property changes received from logind.
+		struct Change {
+			std::string path;			///< @brief D-Bus session path.
+			int locked = -1;			///< @brief New LockedHint (-1 if unchanged).
+			int active = -1;			///< @brief New Active (-1 if unchanged).
+			int idle = -1;				///< @brief New IdleHint (-1 if unchanged).
+			std::string state;			///< @brief New State (empty if unchanged).
+			std::string sid;			///< @brief Session id (SessionNew/SessionRemoved only).
+			int lifecycle = 0;			///< @brief 1 on SessionNew, -1 on SessionRemoved, 0 on property changes.
+
+			Change(const char *p) : path{p ? p : ""} {
+			}
+		};
+
+	private:
+		std::mutex guard;
+		sd_bus *bus = nullptr;
+
+		/// @brief Changes waiting to be applied on sessions.
+		std::vector<Change> changes;
+
+		/// @brief Are we subscribed to logind signals?
+		bool watching = false;
+
+		/// @brief Are we subscribed to SessionNew/SessionRemoved?
+		bool lifecycle = false;
+
+		/// @brief The connection was lost, signals could have been missed.
+		bool lost = false;
+
+		sd_bus_slot *slots[2] = { nullptr, nullptr };
+
+		/// @brief Add signal matches (requires an active guard).
+		void subscribe(sd_bus *bus);
+
+		/// @brief Remove signal matches (requires an active guard).
+		void unsubscribe() noexcept;
+
+		static int on_properties_changed(sd_bus_message *message, void *userdata, sd_bus_error *);
+		static int on_manager_signal(sd_bus_message *message, void *userdata, sd_bus_error *);
+
+		/// @brief Get the system bus connection, reconnect if needed (requires an active guard).
+		sd_bus * connection();
+
+		/// @brief Has the connection queued messages to dispatch or data to send? (requires an active guard).
+		bool pending() noexcept;
+
+		/// @brief Check sd-bus return code, drop connection if it was lost (requires an active guard).
+		void check(int rc) noexcept;
+
+	public:
+
+		/// @brief Pending LockedHint query.
+		struct Query {
+			const std::string path;		///< @brief D-Bus session path.
+			int hint = -1;				///< @brief LockedHint value (-1 if not available).
+
+			Query(const std::string &p) : path{p} {
+			}
+		};
+
+		LoginD() = default;
+		~LoginD();
+
+		/// @brief Subscribe to logind session signals and keep session hints updated.
+		/// @param sessions If true also subscribe to the manager's SessionNew/SessionRemoved signals.
+		void subscribe(bool sessions = false);
+
+		/// @brief Are session hints being updated from logind signals?
+		inline bool subscribed() const noexcept {
+			return watching;
+		}
+
+		/// @brief Was the connection reopened after being lost? (clears the flag).
+		/// @return true if the signals received so far are not reliable and the sessions must be reloaded.
+		bool reconnected() noexcept;
+
+		/// @brief Get connection file descriptor for polling (-1 if not connected).
+		int fd() noexcept;
+
+		/// @brief Get the events to poll for.
+		short events() noexcept;
+
+		/// @brief Dispatch pending messages.
+		/// @return The session changes received since the last call.
+		std::vector<Change> process() noexcept;
+
+		/// @brief Get D-Bus object path for session.
+		std::string path(const char *sid);
+
+		/// @brief Get LockedHint for session.
+		bool locked(const char *path);
+
+		/// @brief Get LockedHint for several sessions, queries are sent in a single batch.
+		void locked(std::vector<Query> &queries);
+
+	};
+
+#if UDJAT_CHECK_VERSION(1,2,0)
+	/// @brief Monitor descriptor polled by the udjat main loop.
+	class User::List::Handler : public MainLoop::Handler {
+	private:
+		const std::function<void(Handler &handler)> callback;
+
+	protected:
+		void handle_event(const Event) override {
+			callback(*this);
+		}
+
+	public:
+		int descriptor;		///< @brief The watched file descriptor.
+
+		Handler(int fd, const std::function<void(Handler &handler)> &c) : MainLoop::Handler{fd,oninput}, callback{c}, descriptor{fd} {
 		}
 
 	};
+#endif // UDJAT_CHECK_VERSION
 
- #endif // HAVE_DBUS
+	/// @brief Watch logind session records for changes.
+	class User::List::Watcher {
+	private:
+		int fd = -1;		///< @brief The inotify descriptor.
+		int wd = -1;		///< @brief Watch descriptor of the sessions directory.
+
+	public:
+
+		/// @brief Session ids changed since the last read.
+		struct Changes {
+			std::set<std::string> created;		///< @brief New session records.
+			std::set<std::string> modified;		///< @brief Updated session records.
+			std::set<std::string> deleted;		///< @brief Removed session records.
+			bool overflow = false;				///< @brief Events were lost, a full refresh is required.
+
+			inline bool empty() const noexcept {
+				return created.empty() && modified.empty() && deleted.empty() && !overflow;
+			}
+		};
+
+		/// @brief Start watching the directory.
+		/// @param path The directory with the logind session records.
+		Watcher(const char *path = "/run/systemd/sessions");
+		~Watcher();
+
+		/// @brief Get the descriptor for polling.
+		inline int descriptor() const noexcept {
+			return fd;
+		}
+
+		/// @brief Read pending events.
+		/// @param changes The changed session ids are added here.
+		void read(Changes &changes);
+
+	};
 
  }
 
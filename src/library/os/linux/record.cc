@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2024 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ /**
+  * @brief Load session records from /run/systemd/sessions.
+  */
+
+ #include <config.h>
+ #include <udjat/tools/user/session.h>
+ #include <udjat/tools/logger.h>
+ #include <sys/stat.h>
+ #include <cstdlib>
+ #include <cstring>
+ #include <fstream>
+ #include <memory>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	/// @brief Parse the logind session file (the same one read by sd_session_get_*).
+	static std::shared_ptr<const User::Session::Record> load(const char *filename, const struct stat &st) {
+
+		ifstream file{filename};
+		if(!file) {
+			return std::shared_ptr<const User::Session::Record>{};
+		}
+
+		auto record = make_shared<User::Session::Record>();
+
+		record->dev = st.st_dev;
+		record->ino = st.st_ino;
+		record->mtime = st.st_mtim.tv_sec;
+		record->mtime_nsec = st.st_mtim.tv_nsec;
+
+		string line;
+		while(getline(file,line)) {
+
+			auto pos = line.find('=');
+			if(pos == string::npos) {
+				continue;
+			}
+
+			const char *key = line.c_str();
+			const char *value = line.c_str()+pos+1;
+			line[pos] = 0;
+
+			if(!strcmp(key,"STATE")) {
+				record->state = value;
+			} else if(!strcmp(key,"UID")) {
+				record->uid = (uid_t) strtoul(value,nullptr,10);
+			} else if(!strcmp(key,"TYPE")) {
+				record->type = value;
+			} else if(!strcmp(key,"CLASS")) {
+				record->classname = value;
+			} else if(!strcmp(key,"SERVICE")) {
+				record->service = value;
+			} else if(!strcmp(key,"DISPLAY")) {
+				record->display = value;
+			} else if(!strcmp(key,"REMOTE")) {
+				record->remote = (atoi(value) != 0);
+			} else if(!strcmp(key,"LEADER")) {
+				record->leader = (pid_t) atoi(value);
+			} else if(!strcmp(key,"SEAT")) {
+				record->seat = value;
+			} else if(!strcmp(key,"VTNR")) {
+				record->vtnr = (unsigned int) strtoul(value,nullptr,10);
+			}
+
+		}
+
+		return record;
+
+	}
+
+	std::shared_ptr<const User::Session::Record> User::Session::record(bool check) const {
+
+		auto current = std::atomic_load(&sdrecord);
+
+		if(current && !check) {
+			return current;
+		}
+
+		string filename{"/run/systemd/sessions/"};
+		filename += sid;
+
+		struct stat st;
+		if(stat(filename.c_str(),&st)) {
+			// Session file is gone, keep the last record.
+			return current;
+		}
+
+		if(current
+			&& current->dev == st.st_dev
+			&& current->ino == st.st_ino
+			&& current->mtime == st.st_mtim.tv_sec
+			&& current->mtime_nsec == st.st_mtim.tv_nsec) {
+			return current;
+		}
+
+		auto record = load(filename.c_str(),st);
+		if(record) {
+			std::atomic_store(&sdrecord,record);
+			return record;
+		}
+
+		return current;
+
+	}
+
+ }
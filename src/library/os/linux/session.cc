@@ -20,7 +20,6 @@
  #include <config.h>
  #include "private.h"
  #include <systemd/sd-login.h>
- #include <systemd/sd-bus.h>
  #include <udjat/tools/configuration.h>
  #include <sys/types.h>
  #include <iostream>
@@ -29,6 +28,9 @@
  #include <functional>
  #include <sys/types.h>
  #include <unistd.h>
+ #include <sys/syscall.h>
+ #include <cstring>
+ #include <cctype>
  #include <mutex>
  #include <udjat/tools/logger.h>
  #include <udjat/tools/quark.h>
@@ -42,7 +44,6 @@
  namespace Udjat {
 
 	User::Session::Session() {
-		User::List::getInstance().push_back(this);
 	}
 
 	User::Session::~Session() {
@@ -53,6 +54,14 @@
 
 		if(flags.remote == 0xFF) {
 
+			User::Session * session = const_cast<User::Session *>(this);
+
+			auto record = this->record();
+			if(record) {
+				session->flags.remote = record->remote ? 1 : 0;
+				return record->remote;
+			}
+
 			// https://www.carta.tech/man-pages/man3/sd_session_is_remote.3.html
 			int rc = sd_session_is_remote(sid.c_str());
 
@@ -61,10 +70,7 @@
 				return false;
 			}
 
-			User::Session * session = const_cast<User::Session *>(this);
-			if(session) {
-				session->flags.remote = rc > 0 ? 1 : 0;
-			}
+			session->flags.remote = rc > 0 ? 1 : 0;
 
 			return rc > 0;
 
@@ -75,6 +81,11 @@
 
 	bool User::Session::active() const noexcept {
 
+		int8_t hint = flags.hints.active;
+		if(hint >= 0) {
+			return hint != 0;
+		}
+
 		int rc = sd_session_is_active(sid.c_str());
 		if(rc < 0) {
 
@@ -88,6 +99,14 @@
 			return false;
 		}
 
+		if(User::List::getInstance().logind->subscribed()) {
+			// Signals will keep it updated; don't overwrite one received while fetching.
+			User::Session *session = const_cast<User::Session *>(this);
+			if(!session->flags.hints.active.compare_exchange_strong(hint,(int8_t) (rc > 0 ? 1 : 0))) {
+				return hint != 0;
+			}
+		}
+
 		return rc > 0;
 
 	}
@@ -98,133 +117,41 @@
 			return dbpath;
 		}
 
-		sd_bus* bus = NULL;
-		int rc;
-
-		rc = sd_bus_open_system(&bus);
-		if(rc < 0) {
-
-			throw system_error(-rc,system_category(),string{"Unable to open system bus (rc="}+std::to_string(rc)+")");
-		}
-
-		sd_bus_error error = SD_BUS_ERROR_NULL;
-		sd_bus_message *reply = NULL;
-
-		std::string response;
-
-		try {
-
-			rc = sd_bus_call_method(
-							bus,
-							"org.freedesktop.login1",
-							"/org/freedesktop/login1",
-							"org.freedesktop.login1.Manager",
-							"GetSession",
-							&error,
-							&reply,
-							"s", sid.c_str()
-						);
-
-			if(rc < 0) {
-				string message{error.message};
-				sd_bus_error_free(&error);
-				throw system_error(-rc,system_category(),message);
-			} else if(!reply) {
-				throw runtime_error("No reply from org.freedesktop.login1.Manager.GetSession");
-			}
-
-			const char *path = NULL;
-			rc = sd_bus_message_read_basic(reply,SD_BUS_TYPE_OBJECT_PATH,&path);
-			if(rc < 0) {
-				sd_bus_message_unref(reply);
-				throw system_error(-rc,system_category(),"org.freedesktop.login1.Manager.GetSession");
-
-			}
-			if(!(path && *path)) {
-				sd_bus_message_unref(reply);
-				throw runtime_error("Empty response from org.freedesktop.login1.Manager.GetSession");
-			}
-
-			response = path;
-			trace() << "D-Bus Session path for @" << sid << " is " << response << endl;
-
-			sd_bus_message_unref(reply);
-
-			User::Session *session = const_cast<User::Session *>(this);
-			if(session) {
-				session->dbpath = response;
-			}
-
-		} catch(...) {
-
-			sd_bus_unref(bus);
-			throw;
+		std::string response{User::List::getInstance().logind->path(sid.c_str())};
+		trace() << "D-Bus Session path for @" << sid << " is " << response << endl;
 
+		User::Session *session = const_cast<User::Session *>(this);
+		if(session) {
+			session->dbpath = response;
 		}
 
-		sd_bus_unref(bus);
-
 		return response;
 
 	}
 
 	bool User::Session::locked() const {
 
-		int hint = 0;
-		int rc = 0;
-		sd_bus* bus = NULL;
-		sd_bus_error error = SD_BUS_ERROR_NULL;
-		sd_bus_message *reply = NULL;
-
-		rc = sd_bus_open_system(&bus);
-		if(rc < 0) {
-
-			throw system_error(-rc,system_category(),string{"Unable to open system bus (rc="}+std::to_string(rc)+")");
+		int8_t hint = flags.hints.locked;
+		if(hint >= 0) {
+			return hint != 0;
 		}
 
-		try {
+		auto &logind = *User::List::getInstance().logind;
+		bool locked = logind.locked(path().c_str());
 
-			rc = sd_bus_call_method(
-							bus,
-							"org.freedesktop.login1",
-							this->path().c_str(),
-							"org.freedesktop.DBus.Properties",
-							"Get",
-							&error,
-							&reply,
-							"ss", "org.freedesktop.login1.Session", "LockedHint"
-						);
-
-			if(rc < 0) {
-				throw system_error(-rc,system_category(),Logger::Message(error.message," (rc=",-rc,")"));
-			} else if(!reply) {
-				throw runtime_error("Empty response from org.freedesktop.login1.LockedHint");
-			} else {
-
-				// Get reply.
-				if(sd_bus_message_read(reply,"v","b",&hint) < 0) {
-					throw system_error(-rc,system_category(),"Can't read response from org.freedesktop.login1.LockedHint");
-				}
-
-			}
-
-		} catch(...) {
-			if(reply) {
-				sd_bus_message_unref(reply);
+		if(logind.subscribed()) {
+			// Got the initial value, signals will keep it updated; don't overwrite one received while fetching.
+			User::Session *session = const_cast<User::Session *>(this);
+			if(!session->flags.hints.locked.compare_exchange_strong(hint,(int8_t) (locked ? 1 : 0))) {
+				return hint != 0;
 			}
-			sd_bus_error_free(&error);
-			sd_bus_unref(bus);
-			throw;
-		}
-
-		sd_bus_error_free(&error);
-		if(reply) {
-			sd_bus_message_unref(reply);
 		}
-		sd_bus_unref(bus);
 
-		return (hint != 0);
+		return locked;
+	}
 
+	std::string User::Session::id() const {
+		return sid;
 	}
 
 	bool User::Session::system() const {
@@ -233,6 +160,11 @@
 
 	std::string User::Session::display() const {
 
+		auto record = this->record();
+		if(record) {
+			return record->display;
+		}
+
 		char *display = NULL;
 
 		int rc = sd_session_get_display(sid.c_str(),&display);
@@ -248,6 +180,11 @@
 
 	std::string User::Session::type() const {
 
+		auto record = this->record();
+		if(record) {
+			return record->type;
+		}
+
 		char *type = NULL;
 
 		int rc = sd_session_get_type(sid.c_str(),&type);
@@ -268,15 +205,29 @@
 		}
 
 		//
-		// Get session class name.
+		// Get session service name.
 		//
 		char *servicename = NULL;
 
-		int rc = sd_session_get_service(sid.c_str(),&servicename);
-		if(rc < 0 || !servicename) {
-			rc = -rc;
-			warning() << "sd_session_get_service(" << sid << "): " << strerror(rc) << " (rc=" << rc << "), assuming empty" << endl;
-			return "";
+		auto record = this->record();
+		if(record) {
+
+			servicename = strdup(record->service.c_str());
+
+		} else {
+
+			int rc = sd_session_get_service(sid.c_str(),&servicename);
+			if(rc < 0 || !servicename) {
+				rc = -rc;
+				warning() << "sd_session_get_service(" << sid << "): " << strerror(rc) << " (rc=" << rc << "), assuming empty" << endl;
+				return "";
+			}
+
+		}
+
+		// Interned in lowercase, alert filters are matched by pointer.
+		for(char *ptr = servicename; *ptr; ptr++) {
+			*ptr = tolower(*ptr);
 		}
 
 		const char *name = Quark{servicename}.c_str();
@@ -303,11 +254,25 @@
 		//
 		char *classname = NULL;
 
-		int rc = sd_session_get_class(sid.c_str(),&classname);
-		if(rc < 0 || !classname) {
-			rc = -rc;
-			warning() << "sd_session_get_class(" << sid << "): " << strerror(rc) << " (rc=" << rc << "), assuming empty" << endl;
-			return "";
+		auto record = this->record();
+		if(record) {
+
+			classname = strdup(record->classname.c_str());
+
+		} else {
+
+			int rc = sd_session_get_class(sid.c_str(),&classname);
+			if(rc < 0 || !classname) {
+				rc = -rc;
+				warning() << "sd_session_get_class(" << sid << "): " << strerror(rc) << " (rc=" << rc << "), assuming empty" << endl;
+				return "";
+			}
+
+		}
+
+		// Interned in lowercase, alert filters are matched by pointer.
+		for(char *ptr = classname; *ptr; ptr++) {
+			*ptr = tolower(*ptr);
 		}
 
 		const char *name = Quark{classname}.c_str();
@@ -331,6 +296,12 @@
 
 		User::Session *session = const_cast<User::Session *>(this);
 
+		auto record = this->record();
+		if(record) {
+			session->uid = record->uid;
+			return session->uid;
+		}
+
 		int rc = sd_session_get_uid(session->sid.c_str(), &session->uid);
 
 		if(rc < 0) {
@@ -344,13 +315,28 @@
 		call(userid(),exec);
 	}
 
-	void User::Session::call(const uid_t uid, const std::function<void()> exec) {
+	/// @brief Set the effective uid of the calling thread only.
+	/// @see https://man7.org/linux/man-pages/man2/setresuid.2.html (C library/kernel differences)
+	static int thread_seteuid(uid_t uid) noexcept {
+		// The glibc wrapper applies the change to every thread of the
+		// process, the raw syscall affects only the calling one.
+#ifdef SYS_setresuid32
+		return syscall(SYS_setresuid32, (uid_t) -1, uid, (uid_t) -1);
+#else
+		return syscall(SYS_setresuid, (uid_t) -1, uid, (uid_t) -1);
+#endif // SYS_setresuid32
+	}
 
-		static mutex guard;
-		lock_guard<mutex> lock(guard);
+	void User::Session::call(const uid_t uid, const std::function<void()> exec) {
 
 		uid_t saved_uid = geteuid();
-		if(seteuid(uid) < 0) {
+
+		if(saved_uid == uid) {
+			exec();
+			return;
+		}
+
+		if(thread_seteuid(uid) < 0) {
 			throw std::system_error(errno, std::system_category(), "Cant set effective user id");
 		}
 
@@ -359,11 +345,13 @@
 			exec();
 
 		} catch(...) {
-			seteuid(saved_uid);
+			thread_seteuid(saved_uid);
 			throw;
 		}
 
-		seteuid(saved_uid);
+		if(thread_seteuid(saved_uid) < 0) {
+			Logger::String{"Cant restore effective user id: ",strerror(errno)}.error("users");
+		}
 
 	}
 
@@ -377,36 +365,34 @@
 				return "";
 			}
 
-			if(sd_session_get_uid(sid.c_str(), &session->uid)) {
+			auto record = this->record();
+			if(record) {
+				session->uid = record->uid;
+			}
 
-				session->uid = -1;
-				session->username = "@";
-				session->username += sid;
+			session->uname = nullptr;
 
+			if(!record && sd_session_get_uid(sid.c_str(), &session->uid)) {
+				session->uid = -1;
 			} else {
-
-				int bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
-				if (bufsize < 0)
-					bufsize = 16384;
-
-				string rc;
-				char * buf = new char[bufsize];
-
-				struct passwd     pwd;
-				struct passwd   * result;
-				if(getpwuid_r(uid, &pwd, buf, bufsize, &result)) {
-					session->username = "@";
-					session->username += sid;
-				} else {
-					session->username = buf;
+				try {
+					// Interned, shared by all sessions of the user.
+					session->uname = Names::getInstance().get(uid);
+				} catch(const std::exception &e) {
+					cerr << "user\t" << e.what() << endl;
 				}
-				delete[] buf;
+			}
 
+			if(uname) {
+				session->username = uname;
+			} else {
+				session->username = "@";
+				session->username += sid;
 			}
 
 		}
 
-		return username.c_str();
+		return uname ? uname : username.c_str();
 
 	}
 
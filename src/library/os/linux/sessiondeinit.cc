@@ -23,15 +23,12 @@
  #include <udjat/tools/user/session.h>
  #include <iostream>
 
- #ifdef HAVE_DBUS
-	#include <udjat/tools/dbus.h>
- #endif // HAVE_DBUS
-
  using namespace std;
 
  namespace Udjat {
 
 	void User::Session::deinit() {
+		userbus.reset();
 	}
 
  }
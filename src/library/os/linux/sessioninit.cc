@@ -25,10 +25,7 @@
  #include <iostream>
  #include <udjat/tools/threadpool.h>
  #include <udjat/tools/logger.h>
-
- #ifdef HAVE_DBUS
-	#include <udjat/tools/dbus/connection.h>
- #endif // HAVE_DBUS
+ #include <systemd/sd-bus.h>
 
  using namespace std;
 
@@ -36,8 +33,13 @@
 
 	void User::Session::init() {
 
+		// Parse the session record once, the accessors below will use it.
+		auto record = this->record(true);
+
 		// Get UID (if available).
-		if(sd_session_get_uid(sid.c_str(), &uid) < 0) {
+		if(record) {
+			uid = record->uid;
+		} else if(sd_session_get_uid(sid.c_str(), &uid) < 0) {
 			uid = -1;
 		}
 
@@ -59,110 +61,148 @@
 			" class=",classname()
 		}.write(Logger::Debug,name());
 
-		if(!remote() && Config::Value<bool>("user-session","open-session-bus",true)) {
+	}
+
+	bool User::Session::wants_userbus() const {
 
-#ifdef HAVE_DBUS
-			try {
+		if(remote() || !Config::Value<bool>("user-session","open-session-bus",true)) {
+			return false;
+		}
 
-				string busname = getenv("DBUS_SESSION_BUS_ADDRESS");
+		// The user bus is only used to watch the screensaver lock state.
+		if(!List::getInstance().handles((Event) (User::lock|User::unlock))) {
+			return false;
+		}
 
-				if(busname.empty()) {
+		string type{this->type()};
+		return type == "x11" || type == "wayland" || type == "mir";
 
-					Logger::String{"Unable to get user bus address"}.trace(to_string().c_str());
+	}
 
-				} else {
+	void User::Session::update_userbus() noexcept {
 
-					// Connect to user's session bus.
-					// Using session->call because you've to change the euid to
-					// get access to the bus.
-					call([this, &busname](){
-						Logger::String{"Connecting to ",busname.c_str()}.trace(to_string().c_str());
-						userbus = make_shared<Bus>(to_string().c_str(),busname.c_str());
-					});
+		if(flags.state == SessionInForeground) {
 
-					// Is the session locked?
-					userbus->call(
-						"org.gnome.ScreenSaver",
-						"/org/gnome/ScreenSaver",
-						"org.gnome.ScreenSaver",
-						"GetActiveTime",
-						[this](DBus::Message & message) {
+			if(!userbus && wants_userbus()) {
+				open_userbus();
+			}
+
+		} else if(userbus && (flags.state == SessionInBackground || flags.state == SessionIsClosing)) {
+
+			Logger::String{"Closing user bus"}.trace(to_string().c_str());
+			userbus.reset();
+
+		}
+
+		// Preloaded environment is only used on the first state update.
+		environment.clear();
+
+	}
 
-							// Got an async d-bus response, check it.
+	void User::Session::open_userbus() {
 
-							if(message) {
+		try {
 
-								unsigned int active;
-								message.pop(active);
+			string busname = busaddress();
 
-								if(active) {
+			if(busname.empty()) {
 
-									flags.locked = true;
-									info() << "gnome-screensaver is active" << endl;
+				Logger::String{"Unable to get user bus address"}.trace(to_string().c_str());
 
-								} else {
+			} else {
 
-									info() << "gnome-screensaver is not active" << endl;
+				// Connect to user's session bus.
+				// Using session->call because you've to change the euid to
+				// get access to the bus.
+				call([this, &busname](){
+					Logger::String{"Connecting to ",busname.c_str()}.trace(to_string().c_str());
+					userbus = make_shared<Bus>(to_string().c_str(),busname.c_str());
+				});
 
-								}
+				// Only now, with the original euid; the dispatcher thread is
+				// started on the first connection and inherits the credentials.
+				Bus::Dispatcher::getInstance().insert(userbus.get());
+
+				// Is the session locked?
+				userbus->call(
+					"org.gnome.ScreenSaver",
+					"/org/gnome/ScreenSaver",
+					"org.gnome.ScreenSaver",
+					"GetActiveTime",
+					[this](sd_bus_message *message, const sd_bus_error *failure) {
+
+						// Got an async d-bus response, check it.
+
+						if(message) {
+
+							uint32_t active = 0;
+							sd_bus_message_read(message,"u",&active);
+
+							if(active) {
+
+								flags.locked = true;
+								info() << "gnome-screensaver is active" << endl;
 
 							} else {
 
-								error() << "Error calling org.gnome.ScreenSaver.GetActiveTime: "  << message.error_message() << endl;
+								info() << "gnome-screensaver is not active" << endl;
 
 							}
-						}
-					);
-
-					// Subscribe to gnome-screensaver
-					// Hack to avoid gnome-screensaver lack of logind signal.
-
-					// This would be far more easier with the fix of the issue
-					// https://gitlab.gnome.org/GNOME/gnome-shell/-/issues/741#
-					userbus->subscribe(
-						"org.gnome.ScreenSaver",
-						"ActiveChanged",
-						[this](DBus::Message &message) {
-
-							// Active state of gnome screensaver has changed, deal with it.
-							bool locked = DBus::Value(message).as_bool();
-							if(locked != flags.locked) {
-								info() << "Gnome screensaver is now " << (locked ? "active" : "inactive") << endl;
-								flags.locked = locked;
-								ThreadPool::getInstance().push("user-lock-emission",[this,locked](){
-									emit( (locked ? User::lock : User::unlock) );
-								});
-							}
 
-						}
-					);
+						} else {
 
-					// Another gnome signal from https://gitlab.gnome.org/GNOME/gnome-shell/-/blob/wip/jimmac/typography/data/dbus-interfaces/org.gnome.ScreenSaver.xml
-					userbus->subscribe(
-						"org.gnome.ScreenSaver",
-						"WakeUpScreen",
-						[this](DBus::Message &) {
+							error() << "Error calling org.gnome.ScreenSaver.GetActiveTime: "  << ((failure && failure->message) ? failure->message : "Unexpected error") << endl;
 
-							Logger::String{"Gnome screen saver WakeUpScreen signal"}.trace(name());
+						}
+					}
+				);
+
+				// Subscribe to gnome-screensaver
+				// Hack to avoid gnome-screensaver lack of logind signal.
+
+				// This would be far more easier with the fix of the issue
+				// https://gitlab.gnome.org/GNOME/gnome-shell/-/issues/741#
+				userbus->subscribe(
+					"org.gnome.ScreenSaver",
+					"ActiveChanged",
+					[this](sd_bus_message *message) {
+
+						// Active state of gnome screensaver has changed, deal with it.
+						int active = 0;
+						if(sd_bus_message_read(message,"b",&active) < 0) {
+							return;
+						}
 
+						bool locked = (active != 0);
+						if(flags.locked.exchange(locked) != locked) {
+							info() << "Gnome screensaver is now " << (locked ? "active" : "inactive") << endl;
+							ThreadPool::getInstance().push("user-lock-emission",[this,locked](){
+								emit( (locked ? User::lock : User::unlock) );
+							});
 						}
-					);
 
-				}
+					}
+				);
 
-			} catch(const exception &e) {
+				// Another gnome signal from https://gitlab.gnome.org/GNOME/gnome-shell/-/blob/wip/jimmac/typography/data/dbus-interfaces/org.gnome.ScreenSaver.xml
+				userbus->subscribe(
+					"org.gnome.ScreenSaver",
+					"WakeUpScreen",
+					[this](sd_bus_message *) {
 
-				error() << e.what() << endl;
+						Logger::String{"Gnome screen saver WakeUpScreen signal"}.trace(name());
 
-			}
+					}
+				);
 
-#else
+			}
 
-			warning() << "Built without Udjat::DBus, unable to watch gnome screensaver" << endl;
+		} catch(const exception &e) {
 
-#endif // HAVE_DBUS
+			error() << e.what() << endl;
 
 		}
 
 	}
+
  }
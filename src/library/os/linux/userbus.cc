@@ -0,0 +1,447 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2024 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ /**
+  * @brief Implements the user bus connections and their shared dispatcher.
+  */
+
+ #include <config.h>
+ #include "private.h"
+ #include <systemd/sd-bus.h>
+ #include <udjat/tools/logger.h>
+ #include <sys/epoll.h>
+ #include <sys/eventfd.h>
+ #include <pthread.h>
+ #include <unistd.h>
+ #include <climits>
+ #include <cstring>
+ #include <ctime>
+ #include <algorithm>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	/// @brief Get CLOCK_MONOTONIC time in microseconds.
+	static uint64_t monotonic_usec() noexcept {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		return ((uint64_t) ts.tv_sec) * 1000000ULL + (ts.tv_nsec / 1000);
+	}
+
+	User::Session::Bus::Bus(const char *n, const char *address) : name{n} {
+
+		int rc = sd_bus_new(&bus);
+		if(rc < 0) {
+			bus = nullptr;
+			throw system_error(-rc,system_category(),"Unable to create user bus");
+		}
+
+		rc = sd_bus_set_address(bus,address);
+		if(rc >= 0) {
+			rc = sd_bus_set_bus_client(bus,1);
+		}
+		if(rc >= 0) {
+			// Connect and authenticate with the calling thread's effective id.
+			rc = sd_bus_start(bus);
+		}
+
+		if(rc < 0) {
+			sd_bus_unref(bus);
+			bus = nullptr;
+			throw system_error(-rc,system_category(),string{"Unable to connect to "} + address);
+		}
+
+	}
+
+	User::Session::Bus::~Bus() {
+
+		// Waits for a running dispatch.
+		Dispatcher::getInstance().remove(this);
+
+		lock_guard<mutex> lock(guard);
+		for(sd_bus_slot *slot : slots) {
+			sd_bus_slot_unref(slot);
+		}
+		slots.clear();
+
+		if(bus) {
+			sd_bus_flush_close_unref(bus);
+			bus = nullptr;
+		}
+
+	}
+
+	int User::Session::Bus::on_reply(sd_bus_message *message, void *userdata, sd_bus_error *) {
+
+		const Reply &reply = *((const Reply *) userdata);
+
+		if(sd_bus_message_is_method_error(message,NULL)) {
+			reply(nullptr,sd_bus_message_get_error(message));
+		} else {
+			reply(message,nullptr);
+		}
+
+		return 0;
+	}
+
+	int User::Session::Bus::on_signal(sd_bus_message *message, void *userdata, sd_bus_error *) {
+		(*((const Signal *) userdata))(message);
+		return 0;
+	}
+
+	void User::Session::Bus::call(const char *destination, const char *path, const char *interface, const char *member, const Reply &reply) {
+
+		{
+			lock_guard<mutex> lock(guard);
+
+			replies.push_back(reply);
+
+			sd_bus_slot *slot = nullptr;
+			int rc = sd_bus_call_method_async(bus,&slot,destination,path,interface,member,on_reply,&replies.back(),"");
+			if(rc < 0) {
+				replies.pop_back();
+				throw system_error(-rc,system_category(),string{"Error calling "} + interface + "." + member);
+			}
+
+			slots.push_back(slot);
+		}
+
+		// Has data to send.
+		Dispatcher::getInstance().update(this);
+
+	}
+
+	void User::Session::Bus::subscribe(const char *interface, const char *member, const Signal &signal) {
+
+		string rule{"type='signal',interface='"};
+		rule += interface;
+		rule += "',member='";
+		rule += member;
+		rule += "'";
+
+		{
+			lock_guard<mutex> lock(guard);
+
+			signals.push_back(signal);
+
+			sd_bus_slot *slot = nullptr;
+			int rc = sd_bus_add_match(bus,&slot,rule.c_str(),on_signal,&signals.back());
+			if(rc < 0) {
+				signals.pop_back();
+				throw system_error(-rc,system_category(),string{"Unable to subscribe to "} + interface + "." + member);
+			}
+
+			slots.push_back(slot);
+		}
+
+		Dispatcher::getInstance().update(this);
+
+	}
+
+	void User::Session::Bus::process() noexcept {
+
+		lock_guard<mutex> lock(guard);
+
+		uint64_t started = monotonic_usec();
+
+		int rc;
+		while((rc = sd_bus_process(bus,NULL)) > 0);
+
+		if(rc < 0) {
+			Logger::String{"Error processing user bus messages: ",strerror(-rc)}.error(name.c_str());
+		}
+
+		uint64_t elapsed = monotonic_usec() - started;
+		dispatches.count++;
+		dispatches.total += elapsed;
+		dispatches.max = std::max(dispatches.max,elapsed);
+
+	}
+
+	User::Session::Bus::Dispatcher & User::Session::Bus::Dispatcher::getInstance() {
+		static Dispatcher instance;
+		return instance;
+	}
+
+	User::Session::Bus::Dispatcher::Dispatcher() {
+
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		if(epfd < 0) {
+			throw system_error(errno,system_category(),"Unable to create epoll descriptor");
+		}
+
+		efd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+		if(efd < 0) {
+			int err = errno;
+			::close(epfd);
+			throw system_error(err,system_category(),"Unable to create event descriptor");
+		}
+
+		struct epoll_event event;
+		memset(&event,0,sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = efd;
+		epoll_ctl(epfd,EPOLL_CTL_ADD,efd,&event);
+
+	}
+
+	User::Session::Bus::Dispatcher::~Dispatcher() {
+
+		{
+			lock_guard<mutex> lock(guard);
+			enabled = false;
+		}
+
+		if(thread) {
+
+			uint64_t evNum = 1;
+			if(write(efd,&evNum,sizeof(evNum)) != sizeof(evNum)) {
+				debug("Error writing to eventfd");
+			}
+
+			// Wait for the thread, it uses the descriptors and the connection list.
+			if(thread->get_id() == std::this_thread::get_id()) {
+				thread->detach();
+			} else {
+				thread->join();
+			}
+			delete thread;
+			thread = nullptr;
+
+		}
+
+		::close(efd);
+		::close(epfd);
+
+	}
+
+	void User::Session::Bus::Dispatcher::watch(Bus *bus, int op) noexcept {
+
+		int fd;
+		uint32_t events = 0;
+		{
+			lock_guard<mutex> lock(bus->guard);
+			fd = sd_bus_get_fd(bus->bus);
+			int rc = sd_bus_get_events(bus->bus);
+			if(rc > 0) {
+				events = (uint32_t) rc;
+			}
+		}
+
+		if(fd < 0) {
+			return;
+		}
+
+		struct epoll_event event;
+		memset(&event,0,sizeof(event));
+		event.events = events;
+		event.data.fd = fd;
+
+		if(epoll_ctl(epfd,op,fd,&event) < 0) {
+			Logger::String{"epoll_ctl(",fd,"): ",strerror(errno)}.error(bus->name.c_str());
+		}
+
+	}
+
+	void User::Session::Bus::Dispatcher::insert(Bus *bus) {
+
+		lock_guard<mutex> lock(guard);
+
+		int fd;
+		{
+			lock_guard<mutex> lock(bus->guard);
+			fd = sd_bus_get_fd(bus->bus);
+		}
+
+		if(fd < 0) {
+			throw system_error(-fd,system_category(),"Unable to get user bus descriptor");
+		}
+
+		buses[fd] = bus;
+		watch(bus,EPOLL_CTL_ADD);
+
+		if(!thread) {
+			thread = new std::thread([this](){
+				pthread_setname_np(pthread_self(),"user-buses");
+				run();
+			});
+		}
+
+		// Recompute the timeout.
+		uint64_t evNum = 1;
+		if(write(efd,&evNum,sizeof(evNum)) != sizeof(evNum)) {
+			debug("Error writing to eventfd");
+		}
+
+	}
+
+	void User::Session::Bus::Dispatcher::remove(Bus *bus) noexcept {
+
+		lock_guard<mutex> lock(guard);
+
+		for(auto it = buses.begin(); it != buses.end(); it++) {
+
+			if(it->second == bus) {
+
+				epoll_ctl(epfd,EPOLL_CTL_DEL,it->first,NULL);
+				buses.erase(it);
+
+				history.count += bus->dispatches.count;
+				history.total += bus->dispatches.total;
+				history.max = std::max(history.max,bus->dispatches.max);
+
+				break;
+			}
+
+		}
+
+	}
+
+	void User::Session::Bus::Dispatcher::update(Bus *bus) noexcept {
+
+		lock_guard<mutex> lock(guard);
+
+		for(auto &entry : buses) {
+			if(entry.second == bus) {
+				watch(bus,EPOLL_CTL_MOD);
+				break;
+			}
+		}
+
+		uint64_t evNum = 1;
+		if(write(efd,&evNum,sizeof(evNum)) != sizeof(evNum)) {
+			debug("Error writing to eventfd");
+		}
+
+	}
+
+	int User::Session::Bus::Dispatcher::timeout() noexcept {
+
+		// sd-bus timeouts are absolute CLOCK_MONOTONIC times in microseconds.
+		uint64_t next = (uint64_t) -1;
+
+		for(auto &entry : buses) {
+			lock_guard<mutex> lock(entry.second->guard);
+			uint64_t usec = (uint64_t) -1;
+			if(sd_bus_get_timeout(entry.second->bus,&usec) >= 0) {
+				next = std::min(next,usec);
+			}
+		}
+
+		if(next == (uint64_t) -1) {
+			return -1;
+		}
+
+		uint64_t now = monotonic_usec();
+		return (next > now ? (int) std::min<uint64_t>((next - now + 999) / 1000, INT_MAX) : 0);
+
+	}
+
+	void User::Session::Bus::Dispatcher::run() {
+
+		struct epoll_event events[64];
+
+		while(true) {
+
+			int ms;
+			{
+				lock_guard<mutex> lock(guard);
+				if(!enabled) {
+					return;
+				}
+				ms = timeout();
+			}
+
+			int count = epoll_wait(epfd,events,64,ms);
+
+			if(count < 0) {
+				if(errno != EINTR) {
+					Logger::String{"epoll_wait: ",strerror(errno)}.error("user-buses");
+					std::this_thread::sleep_for(std::chrono::seconds(1));
+				}
+				continue;
+			}
+
+			lock_guard<mutex> lock(guard);
+
+			if(!enabled) {
+				return;
+			}
+
+			if(!count) {
+
+				// Timeout, let sd-bus expire the pending calls.
+				for(auto &entry : buses) {
+					entry.second->process();
+					watch(entry.second,EPOLL_CTL_MOD);
+				}
+				continue;
+
+			}
+
+			for(int ix = 0; ix < count; ix++) {
+
+				if(events[ix].data.fd == efd) {
+					uint64_t evNum;
+					if(read(efd,&evNum,sizeof(evNum)) != sizeof(evNum)) {
+						debug("Error reading from eventfd");
+					}
+					continue;
+				}
+
+				auto it = buses.find(events[ix].data.fd);
+				if(it == buses.end()) {
+					// Removed while waiting.
+					continue;
+				}
+
+				it->second->process();
+				watch(it->second,EPOLL_CTL_MOD);
+
+			}
+
+		}
+
+	}
+
+	Value & User::Session::Bus::Dispatcher::getProperties(Value &value) {
+
+		lock_guard<mutex> lock(guard);
+
+		unsigned long count = history.count;
+		uint64_t total = history.total;
+		uint64_t max = history.max;
+
+		for(auto &entry : buses) {
+			lock_guard<mutex> lock(entry.second->guard);
+			count += entry.second->dispatches.count;
+			total += entry.second->dispatches.total;
+			max = std::max(max,entry.second->dispatches.max);
+		}
+
+		value["connections"] = (unsigned int) buses.size();
+		value["dispatches"] = (unsigned int) count;
+		value["latency-avg-us"] = (unsigned int) (count ? (total / count) : 0);
+		value["latency-max-us"] = (unsigned int) max;
+
+		return value;
+	}
+
+ }
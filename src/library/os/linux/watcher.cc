@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2024 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ /**
+  * @brief Watch /run/systemd/sessions with inotify.
+  */
+
+ #include <config.h>
+ #include "private.h"
+ #include <udjat/tools/logger.h>
+ #include <sys/inotify.h>
+ #include <unistd.h>
+ #include <cstring>
+ #include <cerrno>
+ #include <system_error>
+
+ using namespace std;
+
+ namespace Udjat {
+
+	User::List::Watcher::Watcher(const char *path) {
+
+		fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+		if(fd < 0) {
+			throw system_error(errno,system_category(),"Cant initialize inotify");
+		}
+
+		// logind writes a temporary file and renames it over the session record.
+		wd = inotify_add_watch(fd,path,IN_CREATE|IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE);
+		if(wd < 0) {
+			int err = errno;
+			::close(fd);
+			throw system_error(err,system_category(),string{"Cant watch "} + path);
+		}
+
+		Logger::String{"Watching ",path," for session changes"}.trace("users");
+
+	}
+
+	User::List::Watcher::~Watcher() {
+		if(fd >= 0) {
+			::close(fd);
+		}
+	}
+
+	void User::List::Watcher::read(Changes &changes) {
+
+		char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+		while(true) {
+
+			ssize_t length = ::read(fd,buffer,sizeof(buffer));
+
+			if(length < 0) {
+				if(errno == EAGAIN || errno == EINTR) {
+					return;
+				}
+				throw system_error(errno,system_category(),"Cant read inotify events");
+			}
+
+			if(length == 0) {
+				return;
+			}
+
+			for(char *ptr = buffer; ptr < buffer + length; ) {
+
+				const struct inotify_event *event = (const struct inotify_event *) ptr;
+				ptr += sizeof(struct inotify_event) + event->len;
+
+				if(event->mask & IN_Q_OVERFLOW) {
+					changes.overflow = true;
+					continue;
+				}
+
+				if(!event->len || event->name[0] == '.' || strchr(event->name,'.')) {
+					// Temporary files and the session '.ref' fifos.
+					continue;
+				}
+
+				if(event->mask & (IN_DELETE|IN_MOVED_FROM)) {
+					changes.created.erase(event->name);
+					changes.modified.erase(event->name);
+					changes.deleted.insert(event->name);
+				} else if(event->mask & IN_CREATE) {
+					changes.deleted.erase(event->name);
+					changes.created.insert(event->name);
+				} else if(event->mask & (IN_CLOSE_WRITE|IN_MOVED_TO)) {
+					changes.deleted.erase(event->name);
+					if(!changes.created.count(event->name)) {
+						changes.modified.insert(event->name);
+					}
+				}
+
+			}
+
+		}
+
+	}
+
+ }
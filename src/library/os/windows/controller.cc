@@ -38,29 +38,26 @@
  namespace Udjat {
 
 	void User::List::refresh() noexcept {
+		refreshes.requests++;
 		PostMessage(hwnd,WM_REFRESH,0,0);
 	}
 
 	/// @brief Find session (Requires an active guard!!!)
 	User::Session & User::List::find(const DWORD sid) {
 
-		for(auto session : sessions) {
+		for(auto &session : sessions) {
 			if(session->sid == sid) {
 				return *session;
 			}
 		}
 
 		// Not found.
-		Session * session = new Session();
-
-		try {
-			session->sid = sid;
-			session->init();
-		} catch(...) {
-			delete session;
-			throw;
-		}
+		auto session = make_shared<Session>();
+		session->sid = sid;
+		session->init();
 
+		push_back(session);
+		publish();
 		return *session;
 
 		/*
@@ -159,8 +156,39 @@
 
 	}
 
+	bool User::List::get(const std::string &id, const std::function<void(User::Session &session)> &callback) {
+
+		lock_guard<recursive_mutex> lock(guard);
+
+		DWORD sid = (DWORD) std::stoul(id);
+		for(auto &session : sessions) {
+			if(session->sid == sid) {
+				callback(*session);
+				return true;
+			}
+		}
+
+		return false;
+
+	}
+
+	std::unordered_map<const User::Session *, bool> User::List::locked(const Snapshot &sessions) {
+
+		// Lock state is tracked from WTS notifications, no need to query.
+		std::unordered_map<const Session *, bool> states;
+		for(auto &session : sessions) {
+			states[session.get()] = session->flags.locked;
+		}
+		return states;
+
+	}
+
 	void User::List::load(bool starting) noexcept {
 
+		lock_guard<recursive_mutex> lock(guard);
+
+		refreshes.full++;
+
 		WTS_SESSION_INFO	* sessions;
 		DWORD 				  count = 0;
 
@@ -175,8 +203,10 @@
 				Session * session;
 
 				if(starting) {
-					session = new Session();
-					session->sid = sessions[ix].SessionId;
+					auto created = make_shared<Session>();
+					created->sid = sessions[ix].SessionId;
+					push_back(created);
+					session = created.get();
 				} else {
 					session = &find(sessions[ix].SessionId);
 				}
@@ -247,6 +277,7 @@
 		}
 
 		WTSFreeMemory(sessions);
+		publish();
 
 	}
 
@@ -305,10 +336,12 @@
 
 			try {
 
+				lock_guard<recursive_mutex> lock(controller.guard);
+
 				switch((int) wParam) {
 				case WTS_SESSION_LOCK:				// The session has been locked.
 					{
-						auto session = controller.find((DWORD) lParam);
+						User::Session &session = controller.find((DWORD) lParam);
 						session.trace() << "WTS_SESSION_LOCK  (" << session.sid << ")" << endl;
 						if(!session.flags.locked) {
 							session.flags.locked = true;
@@ -319,7 +352,7 @@
 
 				case WTS_SESSION_UNLOCK:			// The session identified has been unlocked.
 					{
-						auto session = controller.find((DWORD) lParam);
+						User::Session &session = controller.find((DWORD) lParam);
 						session.trace() << "WTS_SESSION_UNLOCK  (" << session.sid << ")" << endl;
 						if(session.flags.locked) {
 							session.flags.locked = false;
@@ -330,7 +363,7 @@
 
 				case WTS_CONSOLE_CONNECT:			// The session was connected to the console terminal or RemoteFX session.
 					{
-						auto session = controller.find((DWORD) lParam);
+						User::Session &session = controller.find((DWORD) lParam);
 						session.name(true);
 						session.trace() << "WTS_CONSOLE_CONNECT  (" << session.sid << ")" << endl;
 						session.set(User::SessionInForeground);
@@ -339,7 +372,7 @@
 
 				case WTS_REMOTE_CONNECT:			// The session was connected to the remote terminal.
 					{
-						auto session = controller.find((DWORD) lParam);
+						User::Session &session = controller.find((DWORD) lParam);
 						session.name(true);
 						session.trace() << "WTS_REMOTE_CONNECT  (" << session.sid << ")" << endl;
 						session.flags.remote = true;
@@ -348,27 +381,29 @@
 
 				case WTS_REMOTE_DISCONNECT:			// The session was disconnected from the remote terminal.
 					{
-						auto session = controller.find((DWORD) lParam);
+						User::Session &session = controller.find((DWORD) lParam);
 						session.trace() << "WTS_REMOTE_DISCONNECT  (" << session.sid << ")" << endl;
 						session.flags.remote = true;
 						session.set(User::SessionIsClosing);
-						delete &session;
+						controller.release(&session);
+						controller.publish();
 					}
 					break;
 
 				case WTS_CONSOLE_DISCONNECT:		// The session was disconnected from the console terminal or RemoteFX session.
 					{
-						auto session = controller.find((DWORD) lParam);
+						User::Session &session = controller.find((DWORD) lParam);
 						session.trace() << "WTS_CONSOLE_DISCONNECT  (" << session.sid << ")" << endl;
 						session.flags.remote = false;
 						session.set(User::SessionIsClosing);
-						delete &session;
+						controller.release(&session);
+						controller.publish();
 					}
 					break;
 
 				case WTS_SESSION_LOGON:				// A user has logged on to the session.
 					{
-						auto session = controller.find((DWORD) lParam);
+						User::Session &session = controller.find((DWORD) lParam);
 
 						// Force username update.
 						session.name(true);
@@ -382,11 +417,12 @@
 
 				case WTS_SESSION_LOGOFF:			// A user has logged off the session.
 					{
-						auto session = controller.find((DWORD) lParam);
+						User::Session &session = controller.find((DWORD) lParam);
 						session.trace() << "WTS_SESSION_LOGOFF  (" << session.sid << ")" << endl;
 						session.emit(logoff);
 						session.set(User::SessionIsClosing);
-						delete &session;
+						controller.release(&session);
+						controller.publish();
 					}
 					break;
 
@@ -32,7 +32,6 @@
  namespace Udjat {
 
 	User::Session::Session() {
-		User::List::getInstance().push_back(this);
 	}
 
 	User::Session::~Session() {
@@ -67,6 +66,10 @@
 
 	}
 
+	std::string User::Session::id() const {
+		return std::to_string((int) sid);
+	}
+
 	bool User::Session::system() const {
 
 		return flags.system;
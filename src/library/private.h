@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Copyright (C) 2024 Perry Werneck <perry.werneck@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+ /**
+  * @brief Private declarations for the OS independent library code.
+  */
+
+ #pragma once
+
+ #include <config.h>
+ #include <udjat/defs.h>
+ #include <udjat/tools/user/session.h>
+ #include <udjat/tools/user/list.h>
+ #include <udjat/tools/value.h>
+ #include <condition_variable>
+ #include <deque>
+ #include <memory>
+ #include <mutex>
+ #include <thread>
+
+ namespace Udjat {
+
+	/// @brief Bounded event queue, delivers session events to the agents from a dedicated thread.
+	class User::List::Dispatcher {
+	private:
+
+		std::mutex guard;
+		std::condition_variable wakeup;		///< @brief Signaled when an event is queued or on stop.
+		std::condition_variable idle;		///< @brief Signaled when the queue is empty.
+
+		/// @brief Queued event.
+		struct Entry {
+			std::shared_ptr<Session> session;	///< @brief The session, kept alive until the event is delivered.
+			Event event;
+			Session::Attributes attributes;		///< @brief Session attributes when the event was emitted.
+		};
+
+		std::deque<Entry> queue;
+
+		std::thread *thread = nullptr;
+		bool enabled = true;
+		bool busy = false;
+		bool overflow = false;
+
+		/// @brief Max number of queued events.
+		const size_t limit;
+
+		struct {
+			uint64_t queued = 0;		///< @brief Number of events queued.
+			uint64_t dispatched = 0;	///< @brief Number of events delivered to agents.
+			uint64_t dropped = 0;		///< @brief Number of events dropped by queue overflow.
+			size_t max_depth = 0;		///< @brief Max queue depth.
+		} counters;
+
+		void run() noexcept;
+
+	public:
+		Dispatcher(size_t limit);
+		~Dispatcher();
+
+		/// @brief Queue event.
+		/// @return false if the event was dropped.
+		bool push(std::shared_ptr<Session> session, const Event event, const Session::Attributes &attributes) noexcept;
+
+		/// @brief Wait until all queued events are delivered.
+		void flush() noexcept;
+
+		/// @brief Get queue depth and counters.
+		Value & getProperties(Value &value);
+
+	};
+
+ }
+
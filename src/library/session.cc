@@ -71,7 +71,7 @@
 	}
 
 	void User::Session::emit(const Event &event) noexcept {
-		onEvent(event);
+		List::getInstance().emit(*this,event);
 	}
 
 	std::string User::Session::to_string() const noexcept {
@@ -97,6 +97,10 @@
 					<< endl;
 			this->flags.state = state;
 
+#ifndef _WIN32
+			update_userbus();
+#endif // !_WIN32
+
 			try {
 
 				if(this->flags.state == SessionInForeground) {
@@ -217,13 +221,59 @@
 		return name(false);
 	}
 
+	User::Session::Attributes User::Session::attributes() const noexcept {
+
+		Attributes attributes;
+
+		try {
+
+			if(system()) {
+				attributes.flags |= Attributes::system;
+			}
+
+			if(remote()) {
+				attributes.flags |= Attributes::remote;
+			}
+
+			if(active()) {
+				attributes.flags |= Attributes::active;
+				if(locked()) {
+					attributes.flags |= Attributes::locked;
+				}
+			}
+
+#ifndef _WIN32
+			attributes.classname = classname();
+			attributes.service = service();
+#endif // !_WIN32
+
+			attributes.valid = true;
+
+		} catch(const std::exception &e) {
+
+			error() << "Error getting session attributes: " << e.what() << endl;
+
+		} catch(...) {
+
+			error() << "Unexpected error getting session attributes" << endl;
+
+		}
+
+		return attributes;
+
+	}
+
  	User::Session & User::Session::onEvent(const User::Event &event) noexcept {
+		return onEvent(event,this->attributes());
+	}
+
+ 	User::Session & User::Session::onEvent(const User::Event &event, const Attributes &attributes) noexcept {
 
 		if(Logger::enabled(Logger::Trace)) {
 			Logger::String{
 				"--------> ",std::to_string(event)," sid=",this->sid,
 				" alive=",alive(),
-				" remote=",remote()
+				" remote=",((attributes.flags & Attributes::remote) != 0)
 			}.trace(name());
 		}
 
@@ -238,8 +288,11 @@
 #endif // DEBUG
 		*/
 
-		List::getInstance().for_each([this,event](User::Agent &ag){
-			ag.onEvent(*this,event);
+		// The attributes were captured when the event was emitted, shared by all the agents.
+		List::getInstance().for_each([this,event,&attributes](User::Agent &ag){
+			if(ag.handles(event)) {
+				ag.onEvent(*this,event,attributes);
+			}
 			return false;
 		});
 
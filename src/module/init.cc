@@ -64,13 +64,18 @@
 
 			response.reset(Value::Array);
 
-			for(auto session : User::List::getInstance()) {
+			auto sessions = User::List::getInstance().snapshot();
+
+			auto locked = User::List::getInstance().locked(*sessions);
+
+			for(auto &session : *sessions) {
 
 				Udjat::Value &row = response.append(Value::Object);
 
 				row["name"] = session->to_string();
 				row["remote"] = session->remote();
-				row["locked"] = session->locked();
+				auto hint = locked.find(session.get());
+				row["locked"] = (hint != locked.end() && hint->second);
 				row["active"] = session->active();
 				row["state"] = std::to_string(session->state());
 